@@ -0,0 +1,524 @@
+#ifndef ASSET_IO_HPP
+#define ASSET_IO_HPP
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <condition_variable>
+#include "job_system.hpp"
+
+#if defined(__linux__) && defined(HAVE_LIBURING)
+#define ASSET_IO_URING
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// reads obj, mtl and texture files without a parser waiting on the disk for each of them in turn. a read
+// starts as soon as its path is known and many are in flight at once, which is what hides the latency of
+// a network share. on linux with liburing one io_uring does the opens and reads, files are read in chunks
+// that may land in any order. anywhere else, or when the kernel has no io_uring, a pool of reader threads
+// does blocking reads. every file has an event job that finishes with the read, so decodes can simply
+// depend on it, and a parser can already go through the leading bytes that are in.
+// a streamed read keeps only a window of chunks in memory: later chunks are read once the parser has
+// consumed earlier ones, which are then freed, so a multi-gigabyte obj never sits in ram as a whole
+
+class asset_file {
+public:
+    static constexpr size_t chunk_bytes = 4u << 20;
+    static constexpr size_t window_chunks = 16; //chunks of a streamed read in memory at once
+
+    std::string path;
+    bool streamed;
+    job_handle ready; //finishes once the whole file is in or the read failed
+
+    asset_file(const std::string& path, bool streamed) : path(path), streamed(streamed), contiguous(0), total(0), consumed_chunks(0), issued_chunks(0),
+        complete(false), failed(false), fd(-1), chunks_left(0) {}
+
+    //only final once ready has finished
+    bool ok() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return complete && !failed;
+    }
+
+    //the whole file, only for reads that are not streamed and only after ready
+    const char* data() const { return whole.get(); }
+    //valid once wait_past returned more than zero bytes
+    size_t size() const { return total; }
+    //start of the chunk holding offset, valid until the parser consumed past that chunk
+    const char* chunk_at(size_t offset) const { return streamed ? chunks[offset / chunk_bytes].get() : whole.get() + offset / chunk_bytes * chunk_bytes; }
+
+    //waits until more than offset leading bytes are in or the read ended, returns how many are in
+    size_t wait_past(size_t offset) {
+        size_t in = contiguous.load(std::memory_order_acquire);
+        if (in > offset)
+            return in;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        arrived.wait(lock, [&]() { return contiguous.load(std::memory_order_relaxed) > offset || complete; });
+        return contiguous.load(std::memory_order_relaxed);
+    }
+
+    asset_file(const asset_file&) = delete;
+    asset_file& operator=(const asset_file&) = delete;
+
+private:
+    friend class asset_io;
+    std::mutex mutex;
+    std::condition_variable arrived; //chunks came in, or a streamed read's window moved on
+    std::unique_ptr<char[]> whole;
+    std::vector<std::unique_ptr<char[]>> chunks; //streamed reads only
+    std::vector<bool> chunk_done;
+    std::atomic<size_t> contiguous; //leading bytes that are in
+    size_t total;
+    size_t consumed_chunks, issued_chunks;
+    bool complete, failed;
+    int fd;
+    size_t chunks_left;
+
+    char* chunk_data(size_t chunk) { return streamed ? chunks[chunk].get() : whole.get() + chunk * chunk_bytes; }
+    size_t chunk_length(size_t chunk) const { return std::min(chunk_bytes, total - chunk * chunk_bytes); }
+};
+
+//getline over a file that may still be reading, only waits when the next line is not in yet.
+//chunks of a streamed read are handed back as soon as the line crosses into the next one
+bool read_line(const std::shared_ptr<asset_file>& file, size_t& pos, std::string& line);
+
+class asset_io {
+public:
+    asset_io(size_t reader_count);
+    ~asset_io();
+
+    //a streamed read is meant for one parser going through it front to back with read_line
+    std::shared_ptr<asset_file> read(const std::string& path, bool streamed = false);
+    //frees the chunks of a streamed read before offset and lets the read go on behind them
+    void consume(const std::shared_ptr<asset_file>& file, size_t offset);
+    size_t queue_depth() const { return depth; } //files requested and not completely read
+    size_t bytes_in_flight() const { return in_flight; } //bytes of chunks that are being read
+    const char* backend() const { return uring_ready ? "io_uring" : "reader threads"; }
+
+    asset_io(const asset_io&) = delete;
+    asset_io& operator=(const asset_io&) = delete;
+
+private:
+    static constexpr size_t chunk_bytes = asset_file::chunk_bytes;
+    static constexpr size_t max_chunk_reads = 64; //reads in the ring at once, bigger files queue their remaining chunks
+
+    std::atomic<size_t> depth, in_flight;
+    bool uring_ready;
+
+    std::mutex queue_mutex;
+    std::condition_variable queued;
+    std::deque<std::shared_ptr<asset_file>> waiting;
+    bool stopping;
+    std::vector<std::thread> readers;
+
+    void sized(asset_file& file, size_t size);
+    void arrive(asset_file& file, size_t chunk);
+    void finish(const std::shared_ptr<asset_file>& file, bool failed);
+    void read_blocking(const std::shared_ptr<asset_file>& file);
+
+#ifdef ASSET_IO_URING
+    class uring_op {
+    public:
+        enum op_kind { open_file, stat_file, read_chunk, stop };
+        op_kind kind;
+        std::shared_ptr<asset_file> file;
+        size_t chunk, offset, length;
+        struct statx stat;
+    };
+
+    io_uring ring;
+    std::thread reaper;
+    std::mutex submit_mutex; //the submission side is shared by read and the reaper, completions are the reaper's alone
+    std::deque<uring_op*> chunk_reads;
+    size_t chunk_reads_in_ring;
+    bool reaper_stopping;
+
+    void queue(uring_op* op);
+    void issue(const std::shared_ptr<asset_file>& file);
+    void pump();
+    void complete(uring_op* op, int result);
+    void chunk_ended(const std::shared_ptr<asset_file>& file);
+    void reap();
+#endif
+};
+
+//reader threads mostly wait on the disk, so there are more of them than cores. the job system is created
+//first so it outlives this, reads finishing at exit still signal their events
+asset_io::asset_io(size_t reader_count) : depth(0), in_flight(0), uring_ready(false), stopping(false) {
+    jobs();
+
+#ifdef ASSET_IO_URING
+    chunk_reads_in_ring = 0;
+    reaper_stopping = false;
+    if (io_uring_queue_init(256, &ring, 0) == 0) {
+        uring_ready = true;
+        reaper = std::thread([this]() { reap(); });
+        return;
+    }
+#endif
+
+    for (auto r = 0u; r < reader_count; ++r) {
+        readers.emplace_back([this]() {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (true) {
+                queued.wait(lock, [this]() { return stopping || !waiting.empty(); });
+                if (waiting.empty())
+                    return;
+
+                std::shared_ptr<asset_file> next = std::move(waiting.front());
+                waiting.pop_front();
+                lock.unlock();
+                read_blocking(next);
+                lock.lock();
+            }
+        });
+    }
+}
+
+//reads still running are finished first, their buffers may still be written to
+asset_io::~asset_io() {
+#ifdef ASSET_IO_URING
+    if (uring_ready) {
+        {
+            std::lock_guard<std::mutex> lock(submit_mutex);
+            queue(new uring_op{ uring_op::stop, nullptr, 0, 0, 0, {} });
+            io_uring_submit(&ring);
+        }
+        reaper.join();
+        io_uring_queue_exit(&ring);
+        return;
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (auto& reader : readers)
+        reader.join();
+}
+
+std::shared_ptr<asset_file> asset_io::read(const std::string& path, bool streamed) {
+    std::shared_ptr<asset_file> file = std::make_shared<asset_file>(path, streamed);
+    file->ready = jobs().spawn_event("file read");
+    ++depth;
+
+#ifdef ASSET_IO_URING
+    if (uring_ready) {
+        std::lock_guard<std::mutex> lock(submit_mutex);
+        queue(new uring_op{ uring_op::open_file, file, 0, 0, 0, {} });
+        io_uring_submit(&ring);
+        return file;
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        waiting.push_back(file);
+    }
+    queued.notify_one();
+    return file;
+}
+
+//buffers never move after this, readers of the leading bytes rely on that. they are not zero filled,
+//every byte is read before it is handed on
+void asset_io::sized(asset_file& file, size_t size) {
+    std::lock_guard<std::mutex> lock(file.mutex);
+    file.total = size;
+    size_t count = (size + chunk_bytes - 1) / chunk_bytes;
+    if (file.streamed)
+        file.chunks.resize(count);
+    else
+        file.whole.reset(new char[size]);
+    file.chunk_done.assign(count, false);
+    file.chunks_left = count;
+}
+
+void asset_io::consume(const std::shared_ptr<asset_file>& file, size_t offset) {
+    if (!file->streamed)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        size_t keep = std::min(offset / chunk_bytes, file->chunks.size());
+        if (keep <= file->consumed_chunks)
+            return;
+        while (file->consumed_chunks < keep)
+            file->chunks[file->consumed_chunks++].reset();
+    }
+    file->arrived.notify_all();
+
+#ifdef ASSET_IO_URING
+    if (uring_ready) {
+        std::lock_guard<std::mutex> lock(submit_mutex);
+        issue(file);
+        pump();
+        io_uring_submit(&ring);
+    }
+#endif
+}
+
+//chunks can land in any order, only the leading run of them is handed on
+void asset_io::arrive(asset_file& file, size_t chunk) {
+    {
+        std::lock_guard<std::mutex> lock(file.mutex);
+        file.chunk_done[chunk] = true;
+
+        size_t in = file.contiguous.load(std::memory_order_relaxed);
+        while (in < file.total && file.chunk_done[in / chunk_bytes])
+            in = std::min(file.total, (in / chunk_bytes + 1) * chunk_bytes);
+        file.contiguous.store(in, std::memory_order_release);
+    }
+    file.arrived.notify_all();
+}
+
+void asset_io::finish(const std::shared_ptr<asset_file>& file, bool failed) {
+    {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        file->failed = failed;
+        file->complete = true;
+    }
+    file->arrived.notify_all();
+
+    --depth;
+    jobs().signal(file->ready);
+}
+
+//a streamed read holds its reader thread while it waits for the parser to move the window on
+void asset_io::read_blocking(const std::shared_ptr<asset_file>& file) {
+    std::ifstream in(file->path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        finish(file, true);
+        return;
+    }
+
+    size_t size = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+    sized(*file, size);
+
+    for (auto chunk = 0u; chunk < file->chunk_done.size(); ++chunk) {
+        size_t length = file->chunk_length(chunk);
+        if (file->streamed) {
+            std::unique_lock<std::mutex> lock(file->mutex);
+            file->arrived.wait(lock, [&]() { return chunk < file->consumed_chunks + asset_file::window_chunks; });
+            file->chunks[chunk].reset(new char[length]);
+        }
+
+        in_flight += length;
+        bool read = static_cast<bool>(in.read(file->chunk_data(chunk), length));
+        in_flight -= length;
+        if (!read) {
+            finish(file, true);
+            return;
+        }
+
+        arrive(*file, chunk);
+    }
+
+    finish(file, false);
+}
+
+#ifdef ASSET_IO_URING
+//submit_mutex has to be held, the caller submits once it has queued everything
+void asset_io::queue(uring_op* op) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    while (sqe == nullptr) {
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
+    }
+
+    switch (op->kind) {
+    case uring_op::open_file:
+        io_uring_prep_openat(sqe, AT_FDCWD, op->file->path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        break;
+    case uring_op::stat_file:
+        io_uring_prep_statx(sqe, op->file->fd, "", AT_EMPTY_PATH, STATX_SIZE, &op->stat);
+        break;
+    case uring_op::read_chunk:
+        io_uring_prep_read(sqe, op->file->fd, op->file->chunk_data(op->chunk) + (op->offset - op->chunk * chunk_bytes), static_cast<unsigned int>(op->length), op->offset);
+        break;
+    case uring_op::stop:
+        io_uring_prep_nop(sqe);
+        break;
+    }
+    io_uring_sqe_set_data(sqe, op);
+}
+
+//submit_mutex has to be held. chunks are issued in order, a streamed read only up to its window, and
+//once a read failed the chunks not issued yet are written off
+void asset_io::issue(const std::shared_ptr<asset_file>& file) {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    size_t count = file->chunk_done.size();
+    if (file->failed) {
+        file->chunks_left -= count - file->issued_chunks;
+        file->issued_chunks = count;
+        return;
+    }
+
+    size_t limit = file->streamed ? std::min(count, file->consumed_chunks + asset_file::window_chunks) : count;
+    for (; file->issued_chunks < limit; ++file->issued_chunks) {
+        size_t chunk = file->issued_chunks, length = file->chunk_length(chunk);
+        if (file->streamed)
+            file->chunks[chunk].reset(new char[length]);
+        in_flight += length;
+        chunk_reads.push_back(new uring_op{ uring_op::read_chunk, file, chunk, chunk * chunk_bytes, length, {} });
+    }
+}
+
+//chunks of a file whose read already failed are dropped instead of read
+void asset_io::pump() {
+    while (chunk_reads_in_ring < max_chunk_reads && !chunk_reads.empty()) {
+        uring_op* op = chunk_reads.front();
+        chunk_reads.pop_front();
+
+        if (op->file->failed) {
+            in_flight -= op->length;
+            chunk_ended(op->file);
+            delete op;
+            continue;
+        }
+
+        queue(op);
+        ++chunk_reads_in_ring;
+    }
+}
+
+void asset_io::chunk_ended(const std::shared_ptr<asset_file>& file) {
+    if (--file->chunks_left > 0)
+        return;
+
+    close(file->fd);
+    finish(file, file->failed);
+}
+
+//open, then stat for the size, then every chunk as its own read
+void asset_io::complete(uring_op* op, int result) {
+    std::shared_ptr<asset_file> file = op->file;
+
+    if (op->kind == uring_op::open_file) {
+        if (result < 0) {
+            finish(file, true);
+            delete op;
+            return;
+        }
+
+        file->fd = result;
+        op->kind = uring_op::stat_file;
+        queue(op);
+        return;
+    }
+
+    if (op->kind == uring_op::stat_file) {
+        size_t size = static_cast<size_t>(op->stat.stx_size);
+        delete op;
+        if (result < 0 || size == 0) {
+            close(file->fd);
+            finish(file, result < 0);
+            return;
+        }
+
+        sized(*file, size);
+        issue(file);
+        pump();
+        return;
+    }
+
+    --chunk_reads_in_ring;
+
+    //a file that shrank while it was read ends short, that counts as failed
+    if (result <= 0) {
+        file->failed = true;
+        in_flight -= op->length;
+        issue(file);
+        chunk_ended(file);
+        delete op;
+    }
+    else if (static_cast<size_t>(result) < op->length) {
+        in_flight -= result;
+        op->offset += result;
+        op->length -= result;
+        chunk_reads.push_front(op);
+    }
+    else {
+        in_flight -= result;
+        arrive(*file, op->chunk);
+        chunk_ended(file);
+        delete op;
+    }
+
+    pump();
+}
+
+//stops once asked to and no read is left
+void asset_io::reap() {
+    while (!reaper_stopping || depth > 0) {
+        io_uring_cqe* cqe;
+        if (io_uring_wait_cqe(&ring, &cqe) < 0)
+            continue;
+
+        uring_op* op = static_cast<uring_op*>(io_uring_cqe_get_data(cqe));
+        int result = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        if (op->kind == uring_op::stop) {
+            reaper_stopping = true;
+            delete op;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(submit_mutex);
+        complete(op, result);
+        io_uring_submit(&ring);
+    }
+}
+#endif
+
+asset_io& assets() {
+    static asset_io instance(16);
+    return instance;
+}
+
+bool read_line(const std::shared_ptr<asset_file>& file, size_t& pos, std::string& line) {
+    size_t available = file->wait_past(pos);
+    if (pos >= available)
+        return false;
+
+    line.clear();
+    while (true) {
+        size_t chunk_start = pos / asset_file::chunk_bytes * asset_file::chunk_bytes;
+        size_t end = std::min(chunk_start + asset_file::chunk_bytes, available);
+        const char* text = file->chunk_at(pos) + (pos - chunk_start);
+        const char* newline = static_cast<const char*>(std::memchr(text, '\n', end - pos));
+
+        if (newline != nullptr) {
+            line.append(text, newline);
+            pos += newline - text + 1;
+            if (pos % asset_file::chunk_bytes == 0)
+                assets().consume(file, pos);
+            return true;
+        }
+
+        line.append(text, end - pos);
+        pos = end;
+        if (pos % asset_file::chunk_bytes == 0)
+            assets().consume(file, pos);
+
+        if (pos == available) {
+            available = file->wait_past(pos);
+            if (pos >= available)
+                return true;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <glm/glm.hpp>
+
+// offline comparison of the transparency modes. the scene is rendered from a ring of fixed views in every
+// mode into an offscreen target, reporting gpu time per frame, geometry passes, render target memory
+// and the difference to the first mode
+//
+// the composite benchmark times only the final full screen composite at fixed target sizes, the vertex
+// reuse benchmark times front to back peeling with and without the transform feedback pre-pass
+
+class image_difference {
+public:
+    double mean;
+    int max;
+    double changed_fraction;
+
+    image_difference() : mean(0.0), max(0), changed_fraction(0.0) {}
+};
+
+//per channel difference in 0-255 units, a pixel counts as changed when any channel is more than 2 off
+image_difference compare_images(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+    image_difference result;
+    size_t changed = 0, total = 0;
+
+    for (size_t i = 0; i + 3 < a.size() && i + 3 < b.size(); i += 4) {
+        int pixel_max = 0;
+        for (auto c = 0; c < 3; ++c) {
+            int d = std::abs(static_cast<int>(a[i + c]) - static_cast<int>(b[i + c]));
+            result.mean += d;
+            pixel_max = std::max(pixel_max, d);
+        }
+
+        result.max = std::max(result.max, pixel_max);
+        changed += pixel_max > 2;
+        ++total;
+    }
+
+    if (total > 0) {
+        result.mean /= total * 3.0;
+        result.changed_fraction = static_cast<double>(changed) / total;
+    }
+
+    return result;
+}
+
+void run_transparency_benchmark(renderer& r, scene& s, float fov, int views, int repeats) {
+    const int warmup_frames = 10;
+    render_target target(r.width, r.height);
+    glm::mat4 model_matrix = s.framing_matrix();
+    glm::mat4 projection = glm::perspective(glm::radians(fov), (float)r.width / (float)r.height, 0.1f, 100.0f);
+    float pixels_per_unit = r.height / (2.0f * std::tan(glm::radians(fov) * 0.5f));
+    std::vector<std::vector<unsigned char>> reference(views);
+    transparency_mode start_mode = r.mode;
+
+    unsigned int timer;
+    glGenQueries(1, &timer);
+
+    std::cout << "transparency benchmark: " << views << " views, " << repeats << " frames each, " << r.width << "x" << r.height << '\n';
+    std::cout << std::left << std::setw(12) << "mode" << std::setw(10) << "gpu ms" << std::setw(10) << "passes" << std::setw(12) << "targets"
+        << std::setw(12) << "mean diff" << std::setw(10) << "max diff" << "changed px" << '\n';
+
+    for (int m = 0; m < transparency_mode_count; ++m) {
+        if (!r.mode_supported(static_cast<transparency_mode>(m))) {
+            std::cout << std::setw(12) << transparency_mode_names[m] << "not supported by this context" << '\n';
+            continue;
+        }
+
+        r.set_mode(static_cast<transparency_mode>(m));
+        double gpu_ms = 0.0, passes = 0.0;
+        image_difference difference;
+
+        for (int v = 0; v < views; ++v) {
+            orbit_camera view_cam(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 3.0f, 2.0f * glm::pi<float>() * v / views, 0.3f);
+            glm::mat4 view = view_cam.get_view_matrix();
+            s.select_lods(model_matrix, view_cam.get_eye(), pixels_per_unit, 1.0f);
+
+            //lets the adaptive pass count settle on this view before timing
+            for (int i = 0; i < warmup_frames; ++i) {
+                r.render(s, model_matrix, view, projection, target.fbo);
+                glFinish();
+            }
+
+            glBeginQuery(GL_TIME_ELAPSED, timer);
+            for (int i = 0; i < repeats; ++i)
+                r.render(s, model_matrix, view, projection, target.fbo);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed_ns = 0;
+            glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed_ns);
+            gpu_ms += elapsed_ns / 1.0e6 / repeats;
+            passes += r.peel_passes;
+
+            std::vector<unsigned char> image = target.read_pixels();
+            if (m == 0) {
+                reference[v] = std::move(image);
+            }
+            else {
+                image_difference view_difference = compare_images(reference[v], image);
+                difference.mean += view_difference.mean / views;
+                difference.max = std::max(difference.max, view_difference.max);
+                difference.changed_fraction += view_difference.changed_fraction / views;
+            }
+        }
+
+        std::cout << std::left << std::fixed << std::setprecision(3)
+            << std::setw(12) << transparency_mode_names[m] << std::setw(10) << gpu_ms / views
+            << std::setprecision(1) << std::setw(10) << passes / views << std::setw(12) << format_count(r.target_bytes) + "B"
+            << std::setprecision(3) << std::setw(12) << difference.mean << std::setw(10) << difference.max
+            << std::setprecision(2) << difference.changed_fraction * 100.0 << "%" << '\n';
+    }
+
+    glDeleteQueries(1, &timer);
+    r.set_mode(start_mode);
+}
+
+//gpu ms per call of draw, averaged over repeats after a few warmup calls
+double time_gpu_ms(unsigned int timer, int repeats, const std::function<void()>& draw) {
+    for (int i = 0; i < 5; ++i)
+        draw();
+    glFinish();
+
+    glBeginQuery(GL_TIME_ELAPSED, timer);
+    for (int i = 0; i < repeats; ++i)
+        draw();
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed_ns);
+    return elapsed_ns / 1.0e6 / repeats;
+}
+
+//the renderer's single pass array composite against the previous composite, one blended full screen draw
+//per rgba8 layer with the gamma applied in the shader, at 1080p and 4k
+void run_composite_benchmark(renderer& r, const std::string& shader_dir, int repeats) {
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    const int legacy_layer_counts[] = { 1, 2, 10 };
+    int start_width = r.width, start_height = r.height;
+    transparency_mode start_mode = r.mode;
+
+    Shader layer_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/layer_composite.fs").c_str());
+    std::vector<unsigned int> legacy_layers(10);
+    unsigned int timer, quad_vao, quad_vbo, clear_fbo;
+    glGenQueries(1, &timer);
+    glGenTextures(static_cast<int>(legacy_layers.size()), legacy_layers.data());
+    glGenFramebuffers(1, &clear_fbo);
+
+    float quad_vertices[] = {
+        -1.0f,  1.0f,  0.0f, 1.0f,  -1.0f, -1.0f,  0.0f, 0.0f,   1.0f, -1.0f,  1.0f, 0.0f,
+        -1.0f,  1.0f,  0.0f, 1.0f,   1.0f, -1.0f,  1.0f, 0.0f,   1.0f,  1.0f,  1.0f, 1.0f
+    };
+    glGenVertexArrays(1, &quad_vao);
+    glGenBuffers(1, &quad_vbo);
+    glBindVertexArray(quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+    glBindVertexArray(0);
+
+    //two array layers are only allocated for front to back peeling
+    r.set_mode(front_to_back_peeling);
+
+    std::cout << "composite benchmark: " << repeats << " composites per row" << '\n';
+    std::cout << std::left << std::setw(12) << "size" << std::setw(14) << "composite" << std::setw(8) << "layers"
+        << std::setw(10) << "gpu ms" << "gpix/s" << '\n';
+
+    for (auto& size : sizes) {
+        int w = size[0], h = size[1];
+        std::string size_name = std::to_string(w) + "x" + std::to_string(h);
+        double pixels = static_cast<double>(w) * h;
+        render_target target(w, h);
+        r.resize(w, h);
+        glViewport(0, 0, w, h);
+
+        //half covered layers so blending does real work
+        glBindFramebuffer(GL_FRAMEBUFFER, clear_fbo);
+        glClearColor(0.25f, 0.1f, 0.05f, 0.5f);
+        for (auto layer : legacy_layers) {
+            glBindTexture(GL_TEXTURE_2D, layer);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (auto count : legacy_layer_counts) {
+            double ms = time_gpu_ms(timer, repeats, [&]() {
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.fbo);
+                glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                glDisable(GL_DEPTH_TEST);
+
+                layer_shader.use();
+                glBindVertexArray(quad_vao);
+                for (int i = 0; i < count; ++i) {
+                    glActiveTexture(GL_TEXTURE5);
+                    glBindTexture(GL_TEXTURE_2D, legacy_layers[i]);
+                    layer_shader.setInt("screenTexture", 5);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+                glBindVertexArray(0);
+                glDisable(GL_BLEND);
+            });
+
+            std::cout << std::left << std::fixed << std::setprecision(3) << std::setw(12) << size_name << std::setw(14) << "per layer"
+                << std::setw(8) << count << std::setw(10) << ms << std::setprecision(2) << pixels / (ms * 1.0e6) << '\n';
+        }
+
+        for (int count = 1; count <= 2; ++count) {
+            double ms = time_gpu_ms(timer, repeats, [&]() {
+                r.composite(target.fbo, count);
+            });
+
+            std::cout << std::left << std::fixed << std::setprecision(3) << std::setw(12) << size_name << std::setw(14) << "array"
+                << std::setw(8) << count << std::setw(10) << ms << std::setprecision(2) << pixels / (ms * 1.0e6) << '\n';
+        }
+    }
+
+    glDeleteQueries(1, &timer);
+    glDeleteTextures(static_cast<int>(legacy_layers.size()), legacy_layers.data());
+    glDeleteFramebuffers(1, &clear_fbo);
+    glDeleteVertexArrays(1, &quad_vao);
+    glDeleteBuffers(1, &quad_vbo);
+    r.resize(start_width, start_height);
+    r.set_mode(start_mode);
+}
+
+//a small target makes peeling vertex bound, a large one fill bound, transform reuse should only help the first
+void run_vertex_reuse_benchmark(renderer& r, scene& s, float fov, int repeats) {
+    const int sizes[][2] = { { 128, 128 }, { 2560, 1440 } };
+    const char* size_names[] = { "vertex bound", "fill bound" };
+    const int warmup_frames = 10;
+    int start_width = r.width, start_height = r.height;
+    transparency_mode start_mode = r.mode;
+    bool start_reuse = r.reuse_transforms;
+
+    unsigned int timer;
+    glGenQueries(1, &timer);
+    glm::mat4 model_matrix = s.framing_matrix();
+    orbit_camera view_cam(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 3.0f, 0.0f, 0.3f);
+    glm::mat4 view = view_cam.get_view_matrix();
+
+    size_t translucent_vertices = 0;
+    for (auto& cur_model : s.models) {
+        for (auto& cur_mesh : cur_model.meshes) {
+            if (cur_mesh.mesh_mat->translucent)
+                translucent_vertices += cur_mesh.mesh_vertices.size() * cur_mesh.draw_transforms.size();
+        }
+    }
+
+    r.set_mode(front_to_back_peeling);
+    std::cout << "vertex reuse benchmark: front to back peeling, " << repeats << " frames per row" << '\n';
+    std::cout << std::left << std::setw(14) << "case" << std::setw(12) << "size" << std::setw(12) << "transforms"
+        << std::setw(10) << "gpu ms" << std::setw(10) << "passes" << "vertices/frame" << '\n';
+
+    for (int i = 0; i < 2; ++i) {
+        int w = sizes[i][0], h = sizes[i][1];
+        render_target target(w, h);
+        r.resize(w, h);
+        glm::mat4 projection = glm::perspective(glm::radians(fov), (float)w / (float)h, 0.1f, 100.0f);
+        s.select_lods(model_matrix, view_cam.get_eye(), h / (2.0f * std::tan(glm::radians(fov) * 0.5f)), 1.0f);
+
+        for (int reuse = 0; reuse < 2; ++reuse) {
+            r.reuse_transforms = reuse == 1;
+            r.set_mode(front_to_back_peeling);
+
+            for (int f = 0; f < warmup_frames; ++f) {
+                r.render(s, model_matrix, view, projection, target.fbo);
+                glFinish();
+            }
+
+            glBeginQuery(GL_TIME_ELAPSED, timer);
+            for (int f = 0; f < repeats; ++f)
+                r.render(s, model_matrix, view, projection, target.fbo);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed_ns = 0;
+            glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed_ns);
+
+            //without reuse every pass transforms every vertex again
+            size_t vertices = translucent_vertices * (reuse ? 1 : r.peel_passes);
+            std::cout << std::left << std::fixed << std::setprecision(3) << std::setw(14) << size_names[i]
+                << std::setw(12) << std::to_string(w) + "x" + std::to_string(h) << std::setw(12) << (reuse ? "reused" : "per pass")
+                << std::setw(10) << elapsed_ns / 1.0e6 / repeats << std::setw(10) << r.peel_passes << format_count(vertices) << '\n';
+        }
+    }
+
+    glDeleteQueries(1, &timer);
+    r.reuse_transforms = start_reuse;
+    r.resize(start_width, start_height);
+    r.set_mode(start_mode);
+}
+
+#endif
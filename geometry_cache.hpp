@@ -0,0 +1,103 @@
+#ifndef GEOMETRY_CACHE_HPP
+#define GEOMETRY_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+// binary cache of processed geometry, written next to the obj file and
+// keyed on the obj size, write time and the processing options it was built with
+
+const uint32_t geometry_cache_magic = 0x43475648; // "HVGC"
+const uint32_t geometry_cache_version = 3;
+
+class geometry_cache_key {
+public:
+    uint64_t file_size;
+    int64_t write_time;
+    uint32_t options;
+
+    geometry_cache_key() : file_size(0), write_time(0), options(0) {}
+
+    bool operator==(const geometry_cache_key& rhs) const {
+        return file_size == rhs.file_size && write_time == rhs.write_time && options == rhs.options;
+    }
+};
+
+geometry_cache_key make_cache_key(const std::string& model_file_path, uint32_t options) {
+    geometry_cache_key key;
+    std::error_code ec;
+
+    key.file_size = std::filesystem::file_size(model_file_path, ec);
+    if (!ec)
+        key.write_time = static_cast<int64_t>(std::filesystem::last_write_time(model_file_path, ec).time_since_epoch().count());
+    key.options = options;
+
+    return key;
+}
+
+std::string cache_path_for(const std::string& model_file_path) {
+    return model_file_path + ".hvcache";
+}
+
+template <typename T>
+void write_pod(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool read_pod(std::ifstream& in, T& value) {
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+template <typename T>
+void write_vector(std::ofstream& out, const std::vector<T>& values) {
+    uint64_t count = values.size();
+    write_pod(out, count);
+    if (count > 0)
+        out.write(reinterpret_cast<const char*>(values.data()), sizeof(T) * count);
+}
+
+//bytes from the read position to the end, counts read from a corrupt cache are checked against it before anything is allocated
+uint64_t bytes_left(std::ifstream& in) {
+    std::streampos pos = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streampos end = in.tellg();
+    in.seekg(pos);
+    return in && end >= pos ? static_cast<uint64_t>(end - pos) : 0;
+}
+
+template <typename T>
+bool read_vector(std::ifstream& in, std::vector<T>& values) {
+    uint64_t count = 0;
+    if (!read_pod(in, count) || count > bytes_left(in) / sizeof(T))
+        return false;
+
+    values.resize(count);
+    if (count > 0)
+        in.read(reinterpret_cast<char*>(values.data()), sizeof(T) * count);
+
+    return static_cast<bool>(in);
+}
+
+void write_string(std::ofstream& out, const std::string& value) {
+    uint64_t count = value.size();
+    write_pod(out, count);
+    out.write(value.data(), count);
+}
+
+bool read_string(std::ifstream& in, std::string& value) {
+    uint64_t count = 0;
+    if (!read_pod(in, count) || count > bytes_left(in))
+        return false;
+
+    value.resize(count);
+    in.read(value.data(), count);
+
+    return static_cast<bool>(in);
+}
+
+#endif
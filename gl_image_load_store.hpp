@@ -0,0 +1,36 @@
+#ifndef GL_IMAGE_LOAD_STORE_HPP
+#define GL_IMAGE_LOAD_STORE_HPP
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// the bundled glad stops at gl 4.0, the gl 4.2 image load/store and atomic counter
+// entry points the k-buffer needs are loaded by hand once a context is current
+
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_FRAMEBUFFER_BARRIER_BIT 0x00000400
+#define GL_ATOMIC_COUNTER_BARRIER_BIT 0x00001000
+#define GL_ATOMIC_COUNTER_BUFFER 0x92C0
+
+typedef void (APIENTRYP bind_image_texture_proc)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP memory_barrier_proc)(GLbitfield barriers);
+
+bind_image_texture_proc glBindImageTexture_ = nullptr;
+memory_barrier_proc glMemoryBarrier_ = nullptr;
+
+//true when the context is 4.2 or newer and the entry points resolved
+bool load_image_load_store() {
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    if (major < 4 || (major == 4 && minor < 2))
+        return false;
+
+    glBindImageTexture_ = (bind_image_texture_proc)glfwGetProcAddress("glBindImageTexture");
+    glMemoryBarrier_ = (memory_barrier_proc)glfwGetProcAddress("glMemoryBarrier");
+
+    return glBindImageTexture_ && glMemoryBarrier_;
+}
+
+#endif
@@ -7,6 +7,48 @@
 #include <filesystem>
 #include <algorithm>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <functional>
+#include "mesh_simplifier.hpp"
+#include "geometry_cache.hpp"
+#include "vertex_quantization.hpp"
+#include "mesh_optimizer.hpp"
+#include "job_system.hpp"
+#include "asset_io.hpp"
+
+class load_options {
+public:
+    bool generate_lods;
+    bool detect_instances;
+    bool optimize_meshes;
+    bool use_cache;
+    bool compact_vertices;
+    int lod_max_levels;
+    size_t lod_min_triangles;
+    size_t lod_chunk_triangles;
+    float compact_max_position_error; //relative to the model radius
+    float compact_max_uv_error;
+    float overdraw_threshold;
+
+    load_options() : generate_lods{ true }, detect_instances{ true }, optimize_meshes{ true }, use_cache{ true }, compact_vertices{ false }, lod_max_levels{ 5 },
+        lod_min_triangles{ 256 }, lod_chunk_triangles{ 1000000 },
+        compact_max_position_error{ 1e-4f }, compact_max_uv_error{ 1.0f / 2048.0f }, overdraw_threshold{ 1.05f } {
+    }
+
+    uint32_t cache_flags() const {
+        return (generate_lods ? 1u : 0u) | (detect_instances ? 2u : 0u) | (optimize_meshes ? 4u : 0u);
+    }
+};
+
+load_options loader_opts;
+
+//runs on the shared job system, nested loops steal from each other instead of starting threads of their own
+void parallel_for(size_t count, const std::function<void(size_t)>& body, size_t grain = 1, const char* name = "parallel for") {
+    jobs().parallel_for(name, count, grain, body);
+}
 
 bool is_white_space(char c) {
     return std::isspace(static_cast<unsigned int>(c));
@@ -126,9 +168,29 @@ public:
     glm::vec2 texture_coord;
     glm::vec3 vertex_normal;
 
+    vertex() = default;
     vertex(const glm::vec3& vertex_coord, const glm::vec2& texture_coord, const glm::vec3& vertex_normal) :
         vertex_coord(vertex_coord), texture_coord(texture_coord), vertex_normal(vertex_normal) {
     }
+
+    bool operator==(const vertex& rhs) const {
+        return vertex_coord == rhs.vertex_coord && texture_coord == rhs.texture_coord && vertex_normal == rhs.vertex_normal;
+    }
+};
+
+struct vertex_hash {
+    size_t operator()(const vertex& v) const {
+        size_t h = position_hash()(v.vertex_coord);
+        h ^= position_hash()(v.vertex_normal) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= position_hash()(glm::vec3(v.texture_coord, 0.0f)) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+class lod_level {
+public:
+    unsigned int index_offset, index_count;
+    float error;
 };
 
 class mat {
@@ -136,10 +198,11 @@ public:
     glm::vec3 kd, ks;
     float ns, d;
     bool has_kd_map, has_ks_map;
+    bool translucent;
     unsigned char* kd_data, * ks_data;
     int kd_width, kd_height, ks_width, ks_height, kd_nr_channels, ks_nr_channels;
 
-    mat() : kd(0.2), ks(1.0), ns{ 32.0 }, d{ 1.0 }, has_kd_map{ false }, has_ks_map{ false }, kd_data(nullptr),
+    mat() : kd(0.2), ks(1.0), ns{ 32.0 }, d{ 1.0 }, has_kd_map{ false }, has_ks_map{ false }, translucent{ false }, kd_data(nullptr),
         ks_data(nullptr),
         kd_width(0), kd_height(0),
         ks_width(0), ks_height(0),
@@ -150,52 +213,107 @@ public:
         kd = glm::vec3(0.2); ks = glm::vec3(1.0);
         ns = 32.0; d = 1.0;
         has_kd_map = false; has_ks_map = false;
+        translucent = false;
         kd_data = nullptr; ks_data = nullptr;
         kd_width = 0; kd_height = 0;
         ks_width = 0; ks_height = 0;
         kd_nr_channels = 0; ks_nr_channels = 0;
     }
-};
 
-std::unordered_map<std::string, mat> materials;
+    //only translucent materials need depth peeling, anything else is drawn once
+    bool is_translucent() const {
+        if (d < 1.0f)
+            return true;
+
+        if (has_kd_map && kd_nr_channels == 4 && kd_data) {
+            size_t texels = static_cast<size_t>(kd_width) * kd_height;
+            for (size_t i = 0; i < texels; ++i) {
+                if (kd_data[i * 4 + 3] < 255)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+};
 
 class mesh {
 public:
     std::vector<vertex> mesh_vertices;
+    std::vector<unsigned int> mesh_indices;
+    std::vector<lod_level> lods;
+    std::vector<glm::mat4> instance_transforms;
+    std::vector<glm::mat4> draw_transforms;
+    std::string mat_name;
     mat* mesh_mat;
     bool has_alpha_val;
-    unsigned int vao, vbo, diffuse_map, spec_map;
-    mesh() : vao(0), vbo(0), diffuse_map(0), spec_map(0), mesh_mat{ nullptr }, has_alpha_val{ false } {}
+    bool compact;
+    glm::vec3 quant_offset, quant_scale;
+    glm::vec3 bounds_center;
+    float bounds_radius;
+    int cur_lod;
+    unsigned int vao, vbo, ebo, instance_vbo, diffuse_map, spec_map;
+    mesh() : vao(0), vbo(0), ebo(0), instance_vbo(0), diffuse_map(0), spec_map(0), mesh_mat{ nullptr }, has_alpha_val{ false },
+        compact{ false }, quant_offset(0.0f), quant_scale(0.0f), bounds_center(0.0f), bounds_radius(0.0f), cur_lod(0) {
+    }
 
+    void build_index_buffer();
+    bool canonical_frame(glm::vec3& origin, glm::mat3& rotation, float& extent) const;
+    void set_placements(const std::vector<glm::mat4>& placements);
+    void build_lods();
+    void optimize(vertex_cache_stats& before, vertex_cache_stats& after);
+    bool choose_compact_format(float max_position_error, float max_uv_error);
+    size_t vertex_buffer_bytes() const;
+    size_t gpu_bytes() const;
+    void upload();
+    void setup_vertex_array();
     void setup();
+    void release();
+    void bind_material(Shader& shader);
     void draw(Shader& shader);
+    void draw_sorted(Shader& shader, unsigned int sorted_ebo, unsigned int instance, unsigned int index_offset, unsigned int index_count);
+    void capture_transformed(Shader& capture_shader);
+    void draw_transformed(Shader& shader, unsigned int vertex_base);
 
     mesh(const mesh&) = delete;
     mesh& operator=(const mesh&) = delete;
 
     mesh(mesh&& rhs) {
         mesh_vertices = std::move(rhs.mesh_vertices);
+        mesh_indices = std::move(rhs.mesh_indices);
+        lods = std::move(rhs.lods);
+        instance_transforms = std::move(rhs.instance_transforms);
+        draw_transforms = std::move(rhs.draw_transforms);
+        mat_name = std::move(rhs.mat_name);
         mesh_mat = rhs.mesh_mat;
         has_alpha_val = rhs.has_alpha_val;
-        vao = rhs.vao; vbo = rhs.vbo;
+        compact = rhs.compact; quant_offset = rhs.quant_offset; quant_scale = rhs.quant_scale;
+        bounds_center = rhs.bounds_center; bounds_radius = rhs.bounds_radius;
+        cur_lod = rhs.cur_lod;
+        vao = rhs.vao; vbo = rhs.vbo; ebo = rhs.ebo; instance_vbo = rhs.instance_vbo;
         diffuse_map = rhs.diffuse_map; spec_map = rhs.spec_map;
 
-        rhs.vao = 0; rhs.vbo = 0;
+        rhs.vao = 0; rhs.vbo = 0; rhs.ebo = 0; rhs.instance_vbo = 0;
         rhs.diffuse_map = 0; rhs.spec_map = 0;
         rhs.mesh_mat = nullptr;
     }
     mesh& operator=(mesh&& rhs) {
-        glDeleteVertexArrays(1, &vao);
-        glDeleteBuffers(1, &vbo);
-        glDeleteTextures(1, &diffuse_map);
-        glDeleteTextures(1, &spec_map);
+        release();
         mesh_vertices = std::move(rhs.mesh_vertices);
+        mesh_indices = std::move(rhs.mesh_indices);
+        lods = std::move(rhs.lods);
+        instance_transforms = std::move(rhs.instance_transforms);
+        draw_transforms = std::move(rhs.draw_transforms);
+        mat_name = std::move(rhs.mat_name);
         mesh_mat = rhs.mesh_mat;
         has_alpha_val = rhs.has_alpha_val;
-        vao = rhs.vao; vbo = rhs.vbo;
+        compact = rhs.compact; quant_offset = rhs.quant_offset; quant_scale = rhs.quant_scale;
+        bounds_center = rhs.bounds_center; bounds_radius = rhs.bounds_radius;
+        cur_lod = rhs.cur_lod;
+        vao = rhs.vao; vbo = rhs.vbo; ebo = rhs.ebo; instance_vbo = rhs.instance_vbo;
         diffuse_map = rhs.diffuse_map; spec_map = rhs.spec_map;
 
-        rhs.vao = 0; rhs.vbo = 0;
+        rhs.vao = 0; rhs.vbo = 0; rhs.ebo = 0; rhs.instance_vbo = 0;
         rhs.diffuse_map = 0; rhs.spec_map = 0;
         rhs.mesh_mat = nullptr;
 
@@ -203,33 +321,227 @@ public:
     }
 
     ~mesh() {
+        release();
+    }
+};
+
+//meshes that never got uploaded are destroyed on parse threads without a current context, those make no gl calls
+void mesh::release() {
+    if (vao != 0)
         glDeleteVertexArrays(1, &vao);
+    if (vbo != 0)
         glDeleteBuffers(1, &vbo);
+    if (ebo != 0)
+        glDeleteBuffers(1, &ebo);
+    if (instance_vbo != 0)
+        glDeleteBuffers(1, &instance_vbo);
+    if (diffuse_map != 0)
         glDeleteTextures(1, &diffuse_map);
+    if (spec_map != 0)
         glDeleteTextures(1, &spec_map);
+    vao = 0; vbo = 0; ebo = 0; instance_vbo = 0; diffuse_map = 0; spec_map = 0;
+}
+
+//welds the unrolled triangle list into unique vertices and an index buffer
+void mesh::build_index_buffer() {
+    std::unordered_map<vertex, unsigned int, vertex_hash> unique;
+    std::vector<vertex> welded;
+    unique.reserve(mesh_vertices.size());
+    mesh_indices.clear();
+    mesh_indices.reserve(mesh_vertices.size());
+
+    for (auto& v : mesh_vertices) {
+        auto it = unique.emplace(v, static_cast<unsigned int>(welded.size()));
+        if (it.second)
+            welded.push_back(v);
+        mesh_indices.push_back(it.first->second);
     }
-};
 
-void mesh::setup() {
+    mesh_vertices = std::move(welded);
+    lods = { lod_level{ 0, static_cast<unsigned int>(mesh_indices.size()), 0.0f } };
+    instance_transforms = { glm::mat4(1.0f) };
+
+    if (mesh_vertices.empty())
+        return;
+
+    glm::vec3 min_bound(mesh_vertices[0].vertex_coord), max_bound(mesh_vertices[0].vertex_coord);
+    for (auto& v : mesh_vertices) {
+        min_bound = glm::min(min_bound, v.vertex_coord);
+        max_bound = glm::max(max_bound, v.vertex_coord);
+    }
+
+    bounds_center = (min_bound + max_bound) * 0.5f;
+    bounds_radius = 0.0f;
+    for (auto& v : mesh_vertices)
+        bounds_radius = std::max(bounds_radius, glm::length(v.vertex_coord - bounds_center));
+}
+
+//every placement of the model gets every instance of the mesh, this is what goes into the instance buffer
+void mesh::set_placements(const std::vector<glm::mat4>& placements) {
+    draw_transforms.clear();
+    draw_transforms.reserve(placements.size() * instance_transforms.size());
+
+    for (auto& placement : placements) {
+        for (auto& instance : instance_transforms)
+            draw_transforms.push_back(placement * instance);
+    }
+
+    if (instance_vbo != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * draw_transforms.size(), draw_transforms.data(), GL_STATIC_DRAW);
+    }
+}
+
+//frame built from the vertex order, so rigidly moved copies of the same export land on the same local coordinates
+bool mesh::canonical_frame(glm::vec3& origin, glm::mat3& rotation, float& extent) const {
+    if (mesh_vertices.size() < 3)
+        return false;
+
+    origin = glm::vec3(0.0f);
+    for (auto& v : mesh_vertices)
+        origin += v.vertex_coord;
+    origin /= static_cast<float>(mesh_vertices.size());
+
+    float max_distance = 0.0f;
+    for (auto& v : mesh_vertices)
+        max_distance = std::max(max_distance, glm::length(v.vertex_coord - origin));
+
+    if (max_distance == 0.0f)
+        return false;
+
+    extent = max_distance;
+
+    glm::vec3 axis_x(0.0f), axis_y(0.0f);
+    size_t i = 0;
+
+    for (; i < mesh_vertices.size(); ++i) {
+        glm::vec3 d(mesh_vertices[i].vertex_coord - origin);
+        if (glm::length(d) > 0.5f * max_distance) {
+            axis_x = glm::normalize(d);
+            break;
+        }
+    }
+
+    for (++i; i < mesh_vertices.size(); ++i) {
+        glm::vec3 d(mesh_vertices[i].vertex_coord - origin);
+        glm::vec3 perpendicular(d - axis_x * glm::dot(d, axis_x));
+        if (glm::length(d) > 0.5f * max_distance && glm::length(perpendicular) > 0.5f * glm::length(d)) {
+            axis_y = glm::normalize(perpendicular);
+            break;
+        }
+    }
+
+    if (axis_y == glm::vec3(0.0f))
+        return false;
+
+    rotation = glm::mat3(axis_x, axis_y, glm::cross(axis_x, axis_y));
+    return true;
+}
+
+//every lod range is reordered on its own, then the vertices follow the first use in lod 0
+void mesh::optimize(vertex_cache_stats& before, vertex_cache_stats& after) {
+    if (mesh_indices.empty())
+        return;
+
+    before = analyze_vertex_cache(mesh_indices.data(), lods[0].index_count, mesh_vertices.size());
+
+    std::vector<glm::vec3> positions(mesh_vertices.size());
+    for (auto i = 0u; i < mesh_vertices.size(); ++i)
+        positions[i] = mesh_vertices[i].vertex_coord;
+
+    for (auto& lod : lods) {
+        unsigned int* range = mesh_indices.data() + lod.index_offset;
+        optimize_vertex_cache(range, lod.index_count, mesh_vertices.size());
+        optimize_overdraw(range, lod.index_count, positions, loader_opts.overdraw_threshold);
+    }
+
+    std::vector<unsigned int> remap = optimize_vertex_fetch_remap(std::vector<unsigned int>(mesh_indices.begin(), mesh_indices.begin() + lods[0].index_count), mesh_vertices.size());
+    std::vector<vertex> reordered(mesh_vertices.size());
+    for (auto i = 0u; i < mesh_vertices.size(); ++i)
+        reordered[remap[i]] = mesh_vertices[i];
+    for (auto& index : mesh_indices)
+        index = remap[index];
+    mesh_vertices = std::move(reordered);
+
+    after = analyze_vertex_cache(mesh_indices.data(), lods[0].index_count, mesh_vertices.size());
+}
+
+//the compact format is only used when its worst case error stays inside both bounds
+bool mesh::choose_compact_format(float max_position_error, float max_uv_error) {
+    compact = false;
+    if (mesh_vertices.empty())
+        return false;
+
+    glm::vec3 min_bound(mesh_vertices[0].vertex_coord), max_bound(mesh_vertices[0].vertex_coord);
+    float max_abs_uv = 0.0f;
+
+    for (auto& v : mesh_vertices) {
+        min_bound = glm::min(min_bound, v.vertex_coord);
+        max_bound = glm::max(max_bound, v.vertex_coord);
+        max_abs_uv = std::max(max_abs_uv, std::max(std::fabs(v.texture_coord.x), std::fabs(v.texture_coord.y)));
+    }
+
+    quant_offset = min_bound;
+    quant_scale = max_bound - min_bound;
+
+    compact = position_quantization_error(quant_scale) <= max_position_error && uv_quantization_error(max_abs_uv) <= max_uv_error;
+    return compact;
+}
+
+size_t mesh::vertex_buffer_bytes() const {
+    return mesh_vertices.size() * (compact ? sizeof(compact_vertex) : sizeof(vertex));
+}
+
+//what upload() puts on the gpu, textures are counted at 4 bytes per texel and a third more for mips
+size_t mesh::gpu_bytes() const {
+    if (vbo == 0)
+        return 0;
+
+    size_t bytes = vertex_buffer_bytes() + mesh_indices.size() * sizeof(unsigned int) + draw_transforms.size() * sizeof(glm::mat4);
+    if (diffuse_map != 0)
+        bytes += static_cast<size_t>(mesh_mat->kd_width) * mesh_mat->kd_height * 4;
+    if (spec_map != 0)
+        bytes += static_cast<size_t>(mesh_mat->ks_width) * mesh_mat->ks_height * 4 * 4 / 3;
+
+    return bytes;
+}
+
+//buffers and textures, any thread with a context that shares objects with the render context can do this
+void mesh::upload() {
     if (mesh_vertices.size() == 0) {
         return;
     }
 
-    glGenVertexArrays(1, &vao); glGenBuffers(1, &vbo);
-    glBindVertexArray(vao); glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * mesh_vertices.size(), &mesh_vertices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texture_coord));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, vertex_normal));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-    if (mesh_mat == nullptr) {
-        mesh_mat = &materials["default_mat"];
+    if (compact) {
+        std::vector<compact_vertex> packed(mesh_vertices.size());
+        for (auto i = 0u; i < mesh_vertices.size(); ++i) {
+            const vertex& v = mesh_vertices[i];
+            packed[i] = pack_vertex(v.vertex_coord, v.texture_coord, v.vertex_normal, quant_offset, quant_scale);
+        }
+
+        glBufferData(GL_ARRAY_BUFFER, sizeof(compact_vertex) * packed.size(), packed.data(), GL_STATIC_DRAW);
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * mesh_vertices.size(), &mesh_vertices[0], GL_STATIC_DRAW);
     }
 
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(unsigned int) * mesh_indices.size(), mesh_indices.data(), GL_STATIC_DRAW);
+
+    if (instance_transforms.empty())
+        instance_transforms = { glm::mat4(1.0f) };
+    if (draw_transforms.empty())
+        set_placements({ glm::mat4(1.0f) });
+
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * draw_transforms.size(), draw_transforms.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
     if (mesh_mat->has_kd_map) {
         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         glGenTextures(1, &diffuse_map);
@@ -274,7 +586,50 @@ void mesh::setup() {
     }
 }
 
-void mesh::draw(Shader& shader) {
+//vertex arrays are not shared between contexts, so they are made on the thread that draws
+void mesh::setup_vertex_array() {
+    if (mesh_vertices.size() == 0) {
+        return;
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao); glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    if (compact) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(compact_vertex), (void*)offsetof(compact_vertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(compact_vertex), (void*)offsetof(compact_vertex, texture_coord));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(compact_vertex), (void*)offsetof(compact_vertex, normal));
+        glEnableVertexAttribArray(2);
+    }
+    else {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texture_coord));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, vertex_normal));
+        glEnableVertexAttribArray(2);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    for (auto i = 0; i < 4; ++i) {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void mesh::setup() {
+    upload();
+    setup_vertex_array();
+}
+
+void mesh::bind_material(Shader& shader) {
     shader.use();
     shader.setVec3("mat.kd", mesh_mat->kd);
     shader.setBool("mat.has_kd_map", mesh_mat->has_kd_map);
@@ -283,6 +638,9 @@ void mesh::draw(Shader& shader) {
     shader.setFloat("mat.ns", mesh_mat->ns);
     shader.setBool("mat.has_alpha_value", has_alpha_val);
     shader.setFloat("mat.d", mesh_mat->d);
+    shader.setBool("compact_vertices", compact);
+    shader.setVec3("pos_scale", quant_scale);
+    shader.setVec3("pos_offset", quant_offset);
 
     if (mesh_mat->has_kd_map) {
 
@@ -297,32 +655,184 @@ void mesh::draw(Shader& shader) {
         glBindTexture(GL_TEXTURE_2D, spec_map);
         shader.setInt("mat.spec_map", 1);
     }
+}
+
+void mesh::draw(Shader& shader) {
+    bind_material(shader);
+
+    const lod_level& lod = lods.at(cur_lod);
+
+    glBindVertexArray(vao);
+    glDrawElementsInstanced(GL_TRIANGLES, lod.index_count, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * lod.index_offset), draw_transforms.size());
+    glBindVertexArray(0);
+}
+
+//draws one instance with indices from an externally sorted element buffer,
+//the vao is pointed back at its own element buffer and first instance afterwards
+void mesh::draw_sorted(Shader& shader, unsigned int sorted_ebo, unsigned int instance, unsigned int index_offset, unsigned int index_count) {
+    bind_material(shader);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sorted_ebo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    for (auto i = 0; i < 4; ++i)
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::mat4) * instance + sizeof(glm::vec4) * i));
+
+    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * index_offset));
+
+    for (auto i = 0; i < 4; ++i)
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+}
+
+//runs the capture shader once per vertex and instance, the bound transform feedback buffer receives
+//every vertex of instance 0, then of instance 1 and so on
+void mesh::capture_transformed(Shader& capture_shader) {
+    capture_shader.setBool("compact_vertices", compact);
+    capture_shader.setVec3("pos_scale", quant_scale);
+    capture_shader.setVec3("pos_offset", quant_offset);
+
+    glBindVertexArray(vao);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArraysInstanced(GL_POINTS, 0, static_cast<int>(mesh_vertices.size()), static_cast<int>(draw_transforms.size()));
+    glEndTransformFeedback();
+    glBindVertexArray(0);
+}
+
+//draws every instance from captured vertices starting at vertex_base, the vertex stage only fetches them
+void mesh::draw_transformed(Shader& shader, unsigned int vertex_base) {
+    bind_material(shader);
+    shader.setInt("vertex_base", vertex_base);
+    shader.setInt("vertex_count", static_cast<int>(mesh_vertices.size()));
+
+    const lod_level& lod = lods.at(cur_lod);
 
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, mesh_vertices.size());
+    glDrawElementsInstanced(GL_TRIANGLES, lod.index_count, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * lod.index_offset), draw_transforms.size());
     glBindVertexArray(0);
 }
 
+//unrolled triangles handed out while a file is still being parsed, so they can be shown before the model is
+//processed. chunks come in file order with materials not resolved yet, progress is counted in bytes of the file
+class parse_stream {
+public:
+    size_t chunk_triangles;
+
+    parse_stream(size_t chunk_triangles) : chunk_triangles(chunk_triangles), bytes_parsed(0), total_bytes(0), reported_bytes(0), closed(false) {}
+
+    void publish(std::vector<vertex>&& chunk, size_t parsed, size_t total);
+    bool take(std::vector<vertex>& chunk, size_t& parsed, size_t& total);
+    void close();
+
+    parse_stream(const parse_stream&) = delete;
+    parse_stream& operator=(const parse_stream&) = delete;
+
+private:
+    std::mutex mutex;
+    std::deque<std::vector<vertex>> chunks;
+    size_t bytes_parsed, total_bytes, reported_bytes;
+    bool closed;
+};
+
+//an empty chunk only reports progress
+void parse_stream::publish(std::vector<vertex>&& chunk, size_t parsed, size_t total) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes_parsed = parsed;
+    total_bytes = total;
+    if (!closed && !chunk.empty())
+        chunks.push_back(std::move(chunk));
+}
+
+//one chunk per call, false while there is neither a chunk nor another percent of the file parsed since the last call
+bool parse_stream::take(std::vector<vertex>& chunk, size_t& parsed, size_t& total) {
+    std::lock_guard<std::mutex> lock(mutex);
+    chunk.clear();
+    if (!chunks.empty()) {
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+    }
+    else if (bytes_parsed - reported_bytes < total_bytes / 100 || bytes_parsed == reported_bytes) {
+        return false;
+    }
+
+    parsed = reported_bytes = bytes_parsed;
+    total = total_bytes;
+    return true;
+}
+
+//nobody takes chunks anymore, the ones still waiting and any later ones are dropped
+void parse_stream::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    chunks.clear();
+}
+
+//a texture whose file is still reading or decoding, attached to its material once both are done
+class texture_decode {
+public:
+    std::string mat_name;
+    bool specular;
+    std::shared_ptr<asset_file> file;
+    unsigned char* data;
+    int width, height, nr_channels;
+};
+
+//an mtl file parsed by a job as soon as it is read, the textures it names start reading right away
+class mat_file_load {
+public:
+    std::shared_ptr<asset_file> file;
+    job_handle parsed;
+    std::vector<std::pair<std::string, mat>> materials; //in file order, a later definition wins
+    std::deque<texture_decode> decodes; //jobs hold on to their entry, a deque never moves it
+    std::vector<job_handle> decode_jobs;
+};
+
 class model {
 public:
     std::vector<glm::vec3> model_vertices;
     std::vector<glm::vec2> model_texture_vertices;
     std::vector<glm::vec3> model_normals;
     std::vector<mesh> meshes;
+    std::vector<std::string> mat_files;
+    std::unordered_map<std::string, mat> materials;
+    std::string file_path;
     float model_area;
     glm::vec3 model_ac, centroid;
     std::string parent_dir;
     float radius;
+    size_t source_mesh_count;
+    size_t instancing_bytes_saved;
+    vertex_cache_stats cache_before, cache_after;
 
-    model(const std::string& model_file_path);
+    model() : model_area(0.0f), model_ac(0.0f), centroid(0.0f), radius(0.0f), source_mesh_count(0), instancing_bytes_saved(0) {}
+    model(const std::string& model_file_path, bool upload = true, parse_stream* stream = nullptr);
     void unroll_face(std::string& line, size_t index);
     void unroll_v_vn(std::vector<vertex>& temp_vertices, std::string& line, size_t index);
     void unroll_v_vt_vn(std::vector<vertex>& temp_vertices, std::string& line, size_t index);
     void ear_clipping(std::vector<vertex>& temp_vertices, mesh& cur_mesh);
     std::string get_file_path(const std::string& line, size_t index);
-    void parse_mat_file(const std::string& mat_file_path);
+    std::shared_ptr<mat_file_load> load_mat_file(const std::string& mat_file_path);
+    void parse_mat_file(mat_file_load& load);
+    void finish_mat_files(const std::vector<std::shared_ptr<mat_file_load>>& loads);
+    void stream_parsed(parse_stream& stream, size_t& streamed_mesh, size_t& streamed_vertex, size_t bytes_parsed, size_t total_bytes, bool last);
+    void process();
+    void find_instances();
+    void summarize_vertex_cache(const std::vector<vertex_cache_stats>& before, const std::vector<vertex_cache_stats>& after);
+    bool read_cache(const std::string& cache_path, const geometry_cache_key& key);
+    void write_cache(const std::string& cache_path, const geometry_cache_key& key) const;
+    void set_placements(const std::vector<glm::mat4>& placements);
+    void upload();
+    void setup_vertex_arrays();
     void setup();
-    void draw(Shader& shader);
+    void select_lods(const glm::mat4& model_matrix, const glm::vec3& eye, float pixels_per_unit, float max_pixel_error);
+    std::vector<size_t> lod_triangle_counts() const;
+    size_t selected_triangle_count() const;
+    size_t vertex_buffer_bytes() const;
+    size_t gpu_bytes() const;
+    size_t ram_bytes() const;
+    bool has_translucent() const;
+    void draw(Shader& shader, bool translucent);
 
     model(const model&) = delete;
     model& operator=(const model&) = delete;
@@ -465,17 +975,38 @@ std::string model::get_file_path(const std::string& line, size_t index) {
         return temp.string();
 }
 
-void model::parse_mat_file(const std::string& mat_file_path) {
-    std::ifstream mat_file(mat_file_path);
+//the read starts here, parsing waits for it on a worker. the flip is a global of stb_image, it is set
+//before any decode of this file can run
+std::shared_ptr<mat_file_load> model::load_mat_file(const std::string& mat_file_path) {
+    stbi_set_flip_vertically_on_load(true);
+
+    std::shared_ptr<mat_file_load> load = std::make_shared<mat_file_load>();
+    load->file = assets().read(mat_file_path);
+    load->parsed = jobs().spawn("parse mtl", [this, load]() { parse_mat_file(*load); }, { load->file->ready });
+    return load;
+}
+
+//runs as a job, the model's materials are only touched by finish_mat_files
+void model::parse_mat_file(mat_file_load& load) {
     std::string mat_file_line;
+    size_t pos = 0;
 
     std::string cur_mat_name;
     bool first_mat = true;
     mat temp_mat{};
 
-    materials.insert({ "default_mat", temp_mat });
-
-    while (getline(mat_file, mat_file_line)) {
+    auto decode = [&](const std::string& map_path, bool specular) {
+        load.decodes.push_back({ cur_mat_name, specular, assets().read(map_path), nullptr, 0, 0, 0 });
+        texture_decode* target = &load.decodes.back();
+        load.decode_jobs.push_back(jobs().spawn("decode texture", [target]() {
+            if (target->file->ok())
+                target->data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(target->file->data()), static_cast<int>(target->file->size()),
+                    &target->width, &target->height, &target->nr_channels, 0);
+            target->file.reset();
+        }, { target->file->ready }));
+    };
+
+    while (read_line(load.file, pos, mat_file_line)) {
         if (mat_file_line.empty())
             continue;
         size_t line_index = 0;
@@ -485,7 +1016,7 @@ void model::parse_mat_file(const std::string& mat_file_path) {
             size_t index_back = mat_file_line.size() - 1;
 
             if (!first_mat) {
-                materials[cur_mat_name] = temp_mat;
+                load.materials.push_back({ cur_mat_name, temp_mat });
                 cur_mat_name.clear();
                 temp_mat.reset();
             }
@@ -511,46 +1042,52 @@ void model::parse_mat_file(const std::string& mat_file_path) {
             temp_mat.d = get_value(mat_file_line, line_index);
         }
         else if (line_type == "map_Ka" || line_type == "map_Kd") {
-            std::string map_path = get_file_path(mat_file_line, line_index);
-
-            stbi_set_flip_vertically_on_load(true);
-
-            int width, height, nr_channels;
-            unsigned char* data = stbi_load(map_path.data(), &width, &height, &nr_channels, 0);
-
-            if (data) {
-                temp_mat.kd_data = data;
-                temp_mat.has_kd_map = true;
-                temp_mat.kd_nr_channels = nr_channels;
-                temp_mat.kd_width = width;
-                temp_mat.kd_height = height;
-            }
-            else {
-                std::cout << "failed to load kd_map on line: " << line_type << std::endl;
-            }
+            decode(get_file_path(mat_file_line, line_index), false);
         }
         else if (line_type == "map_Ks") {
-            std::string map_path = get_file_path(mat_file_line, line_index);
+            decode(get_file_path(mat_file_line, line_index), true);
+        }
+    }
 
-            stbi_set_flip_vertically_on_load(true);
+    load.materials.push_back({ cur_mat_name, temp_mat });
+}
+
+//files are applied in the order they were named, so a material defined twice ends up as before
+void model::finish_mat_files(const std::vector<std::shared_ptr<mat_file_load>>& loads) {
+    for (auto& load : loads) {
+        jobs().wait(load->parsed);
+        jobs().wait(load->decode_jobs);
+        materials.insert({ "default_mat", mat() });
+
+        for (auto& entry : load->materials)
+            materials[entry.first] = entry.second;
 
-            int width, height, nr_channels;
-            unsigned char* data = stbi_load(map_path.data(), &width, &height, &nr_channels, 0);
+        for (auto& decoded : load->decodes) {
+            if (!decoded.data) {
+                std::cout << "failed to load " << (decoded.specular ? "ks_map" : "kd_map") << " of " << decoded.mat_name << std::endl;
+                continue;
+            }
 
-            if (data) {
-                temp_mat.ks_data = data;
-                temp_mat.has_ks_map = true;
-                temp_mat.ks_nr_channels = nr_channels;
-                temp_mat.ks_width = width;
-                temp_mat.ks_height = height;
+            mat& target = materials[decoded.mat_name];
+            if (decoded.specular) {
+                target.ks_data = decoded.data;
+                target.has_ks_map = true;
+                target.ks_nr_channels = decoded.nr_channels;
+                target.ks_width = decoded.width;
+                target.ks_height = decoded.height;
             }
             else {
-                std::cout << "failed to load ks_map on line: " << mat_file_line << std::endl;
+                target.kd_data = decoded.data;
+                target.has_kd_map = true;
+                target.kd_nr_channels = decoded.nr_channels;
+                target.kd_width = decoded.width;
+                target.kd_height = decoded.height;
             }
         }
     }
 
-    materials[cur_mat_name] = temp_mat;
+    for (auto& entry : materials)
+        entry.second.translucent = entry.second.is_translucent();
 }
 
 void model::ear_clipping(std::vector<vertex>& temp_vertices, mesh& cur_mesh) {
@@ -591,8 +1128,9 @@ void model::ear_clipping(std::vector<vertex>& temp_vertices, mesh& cur_mesh) {
         signed_area += (next[index_one] - current[index_one]) * (next[index_two] + current[index_two]);
     }
 
+    //mirror the projection instead of reversing the polygon, so the same face clips the same way however it is oriented
     if (signed_area > 0) {
-        reverse(temp_vertices.begin(), temp_vertices.end());
+        std::swap(index_one, index_two);
     }
 
     while (temp_vertices.size() > 3) {
@@ -662,12 +1200,9 @@ void model::ear_clipping(std::vector<vertex>& temp_vertices, mesh& cur_mesh) {
     model_area += temp_area;
 }
 
-void model::setup() {
-    for (auto i = 0; i < meshes.size(); ++i) {
-        meshes.at(i).setup();
-    }
-
-    centroid = model_ac / model_area;
+void model::process() {
+    if (model_area > 0.0f)
+        centroid = model_ac / model_area;
 
     for (auto& v : model_vertices) {
         radius = std::max(radius, glm::length(v - centroid));
@@ -676,26 +1211,574 @@ void model::setup() {
     model_vertices.clear();
     model_texture_vertices.clear();
     model_normals.clear();
+
+    meshes.erase(std::remove_if(meshes.begin(), meshes.end(), [](const mesh& cur_mesh) {
+        return cur_mesh.mesh_vertices.empty();
+    }), meshes.end());
+
+    parallel_for(meshes.size(), [this](size_t i) {
+        meshes[i].build_index_buffer();
+    }, 1, "index buffer");
+
+    source_mesh_count = meshes.size();
+    if (loader_opts.detect_instances)
+        find_instances();
+
+    //every mesh runs lods and ordering as one job, so a small mesh does not wait for the lods of a big one
+    std::vector<vertex_cache_stats> before(meshes.size()), after(meshes.size());
+    parallel_for(meshes.size(), [&](size_t i) {
+        if (loader_opts.generate_lods)
+            meshes[i].build_lods();
+        if (loader_opts.optimize_meshes)
+            meshes[i].optimize(before[i], after[i]);
+    }, 1, "lods and ordering");
+
+    if (loader_opts.optimize_meshes)
+        summarize_vertex_cache(before, after);
+}
+
+void model::summarize_vertex_cache(const std::vector<vertex_cache_stats>& before, const std::vector<vertex_cache_stats>& after) {
+    //triangle weighted for acmr, vertex weighted for atvr
+    size_t triangles = 0, vertices = 0;
+    cache_before = vertex_cache_stats(); cache_after = vertex_cache_stats();
+
+    for (auto i = 0u; i < meshes.size(); ++i) {
+        size_t t = meshes[i].lods[0].index_count / 3, v = meshes[i].mesh_vertices.size();
+        cache_before.acmr += before[i].acmr * t; cache_after.acmr += after[i].acmr * t;
+        cache_before.atvr += before[i].atvr * v; cache_after.atvr += after[i].atvr * v;
+        triangles += t; vertices += v;
+    }
+
+    if (triangles == 0 || vertices == 0)
+        return;
+
+    cache_before.acmr /= triangles; cache_after.acmr /= triangles;
+    cache_before.atvr /= vertices; cache_after.atvr /= vertices;
+
+    std::cout << "vertex cache: acmr " << cache_before.acmr << " -> " << cache_after.acmr
+        << ", atvr " << cache_before.atvr << " -> " << cache_after.atvr << std::endl;
+}
+
+//meshes that are rigidly moved copies of an earlier mesh are folded into it as extra instances
+void model::find_instances() {
+    std::vector<glm::vec3> origins(meshes.size());
+    std::vector<glm::mat3> rotations(meshes.size());
+    std::vector<float> tolerances(meshes.size(), 0.0f);
+    std::vector<size_t> hashes(meshes.size(), 0);
+    std::vector<bool> has_frame(meshes.size(), false);
+
+    parallel_for(meshes.size(), [&](size_t i) {
+        const mesh& cur_mesh = meshes[i];
+
+        float extent = 0.0f;
+        if (!cur_mesh.canonical_frame(origins[i], rotations[i], extent))
+            return;
+
+        has_frame[i] = true;
+        tolerances[i] = std::max(extent * 1e-4f, 1e-6f);
+
+        //coarse enough that float noise from the export does not change the hash
+        glm::mat3 to_local(glm::transpose(rotations[i]));
+        size_t h = std::hash<std::string>()(cur_mesh.mat_name) ^ (cur_mesh.mesh_vertices.size() * 0x9e3779b97f4a7c15ull);
+        for (auto& v : cur_mesh.mesh_vertices) {
+            glm::vec3 local(to_local * (v.vertex_coord - origins[i]));
+            glm::vec3 cell(glm::round(local / (tolerances[i] * 64.0f)) + glm::vec3(0.0f)); //+0 folds -0 into 0
+            h ^= position_hash()(cell) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        }
+        for (auto index : cur_mesh.mesh_indices)
+            h ^= index + 0x9e3779b9 + (h << 6) + (h >> 2);
+
+        hashes[i] = h;
+    });
+
+    std::unordered_map<size_t, std::vector<size_t>> prototypes;
+    std::vector<bool> folded(meshes.size(), false);
+    instancing_bytes_saved = 0;
+
+    for (auto i = 0u; i < meshes.size(); ++i) {
+        if (!has_frame[i])
+            continue;
+
+        mesh& cur_mesh = meshes[i];
+        glm::mat3 to_local(glm::transpose(rotations[i]));
+        std::vector<size_t>& candidates = prototypes[hashes[i]];
+
+        for (auto p : candidates) {
+            mesh& prototype = meshes[p];
+            glm::mat3 prototype_to_local(glm::transpose(rotations[p]));
+
+            if (prototype.mesh_mat != cur_mesh.mesh_mat || prototype.mesh_indices != cur_mesh.mesh_indices || prototype.mesh_vertices.size() != cur_mesh.mesh_vertices.size())
+                continue;
+
+            bool same = true;
+            for (auto k = 0u; k < cur_mesh.mesh_vertices.size() && same; ++k) {
+                const vertex& a = prototype.mesh_vertices[k];
+                const vertex& b = cur_mesh.mesh_vertices[k];
+
+                glm::vec3 local_a(prototype_to_local * (a.vertex_coord - origins[p]));
+                glm::vec3 local_b(to_local * (b.vertex_coord - origins[i]));
+
+                same = glm::length(local_a - local_b) <= 4.0f * tolerances[p]
+                    && glm::length(prototype_to_local * a.vertex_normal - to_local * b.vertex_normal) <= 1e-2f
+                    && glm::length(a.texture_coord - b.texture_coord) <= 1e-5f;
+            }
+
+            if (!same)
+                continue;
+
+            //maps the prototype onto this copy: into the prototype frame, then out of the copy frame
+            glm::mat3 rotation(rotations[i] * prototype_to_local);
+            glm::mat4 transform(rotation);
+            transform[3] = glm::vec4(origins[i] - rotation * origins[p], 1.0f);
+
+            prototype.instance_transforms.push_back(transform);
+            instancing_bytes_saved += sizeof(vertex) * cur_mesh.mesh_vertices.size() + sizeof(unsigned int) * cur_mesh.mesh_indices.size() - sizeof(glm::mat4);
+            folded[i] = true;
+            break;
+        }
+
+        if (!folded[i])
+            candidates.push_back(i);
+    }
+
+    size_t write = 0;
+    for (auto i = 0u; i < meshes.size(); ++i) {
+        if (folded[i])
+            continue;
+        if (write != i)
+            meshes[write] = std::move(meshes[i]);
+        ++write;
+    }
+    meshes.resize(write);
+
+    if (meshes.size() < source_mesh_count) {
+        std::cout << "instancing: " << meshes.size() << " unique of " << source_mesh_count << " meshes ("
+            << source_mesh_count - meshes.size() << " duplicates), " << instancing_bytes_saved / 1024 << " KB vram saved" << std::endl;
+    }
+}
+
+//big meshes are cut into slabs along their longest axis so a single scan still simplifies on every core,
+//the cut edges are open so the simplifier keeps them and the slabs stitch back together
+void mesh::build_lods() {
+    struct lod_chunk {
+        std::vector<unsigned int> indices;
+        std::vector<std::vector<unsigned int>> levels;
+        std::vector<float> errors;
+    };
+
+    std::vector<lod_chunk> chunks;
+    size_t triangle_count = mesh_indices.size() / 3;
+
+    if (triangle_count < loader_opts.lod_min_triangles * 4)
+        return;
+
+    size_t chunk_count = (triangle_count + loader_opts.lod_chunk_triangles - 1) / loader_opts.lod_chunk_triangles;
+
+    if (chunk_count <= 1) {
+        chunks.push_back({ mesh_indices, {}, {} });
+    }
+    else {
+        glm::vec3 extent(0.0f);
+        for (auto& v : mesh_vertices)
+            extent = glm::max(extent, glm::abs(v.vertex_coord - bounds_center));
+        int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        std::vector<std::pair<float, unsigned int>> order(triangle_count);
+        for (auto t = 0u; t < triangle_count; ++t) {
+            const auto& idx = mesh_indices;
+            float key = mesh_vertices[idx[t * 3]].vertex_coord[axis] + mesh_vertices[idx[t * 3 + 1]].vertex_coord[axis] + mesh_vertices[idx[t * 3 + 2]].vertex_coord[axis];
+            order[t] = { key, t };
+        }
+        std::sort(order.begin(), order.end());
+
+        for (auto c = 0u; c < chunk_count; ++c) {
+            lod_chunk chunk{ {}, {}, {} };
+            size_t begin = triangle_count * c / chunk_count, end = triangle_count * (c + 1) / chunk_count;
+
+            chunk.indices.reserve((end - begin) * 3);
+            for (auto t = begin; t < end; ++t) {
+                for (auto e = 0; e < 3; ++e)
+                    chunk.indices.push_back(mesh_indices[order[t].second * 3 + e]);
+            }
+
+            chunks.push_back(std::move(chunk));
+        }
+    }
+
+    parallel_for(chunks.size(), [this, &chunks](size_t c) {
+        lod_chunk& chunk = chunks[c];
+
+        std::unordered_map<unsigned int, unsigned int> local_of_global;
+        std::vector<unsigned int> global_of_local;
+        std::vector<glm::vec3> positions, normals;
+        std::vector<unsigned int> current;
+        current.reserve(chunk.indices.size());
+
+        for (auto index : chunk.indices) {
+            auto it = local_of_global.emplace(index, static_cast<unsigned int>(global_of_local.size()));
+            if (it.second) {
+                global_of_local.push_back(index);
+                positions.push_back(mesh_vertices[index].vertex_coord);
+                normals.push_back(mesh_vertices[index].vertex_normal);
+            }
+            current.push_back(it.first->second);
+        }
+
+        mesh_simplifier simplifier(positions, normals);
+        float total_error = 0.0f;
+
+        for (auto level = 1; level < loader_opts.lod_max_levels; ++level) {
+            size_t target = (current.size() / 12) * 3;
+            if (target < loader_opts.lod_min_triangles * 3)
+                break;
+
+            float error = 0.0f;
+            std::vector<unsigned int> next = simplifier.simplify(current, target, error);
+
+            if (next.size() * 10 > current.size() * 9)
+                break;
+
+            total_error += error;
+            current = std::move(next);
+
+            std::vector<unsigned int> level_indices(current.size());
+            for (auto k = 0u; k < current.size(); ++k)
+                level_indices[k] = global_of_local[current[k]];
+
+            chunk.levels.push_back(std::move(level_indices));
+            chunk.errors.push_back(total_error);
+        }
+    }, 1, "simplify chunk");
+
+    size_t level_count = 1;
+    for (auto& chunk : chunks)
+        level_count = std::max(level_count, chunk.levels.size() + 1);
+
+    for (auto level = 1u; level < level_count; ++level) {
+        lod_level lod{ static_cast<unsigned int>(mesh_indices.size()), 0, 0.0f };
+
+        //chunks that ran out of levels contribute their coarsest one
+        for (auto& chunk : chunks) {
+            const std::vector<unsigned int>& source = chunk.levels.empty() ? chunk.indices : chunk.levels[std::min<size_t>(level, chunk.levels.size()) - 1];
+            mesh_indices.insert(mesh_indices.end(), source.begin(), source.end());
+            if (!chunk.levels.empty())
+                lod.error = std::max(lod.error, chunk.errors[std::min<size_t>(level, chunk.levels.size()) - 1]);
+        }
+
+        lod.index_count = static_cast<unsigned int>(mesh_indices.size()) - lod.index_offset;
+
+        if (lod.index_count * 10 > lods.back().index_count * 9) {
+            mesh_indices.resize(lod.index_offset);
+            break;
+        }
+
+        lods.push_back(lod);
+    }
+}
+
+bool model::read_cache(const std::string& cache_path, const geometry_cache_key& key) {
+    std::ifstream in(cache_path, std::ios::binary);
+    if (!in)
+        return false;
+
+    uint32_t magic = 0, version = 0;
+    geometry_cache_key cached_key;
+    if (!read_pod(in, magic) || !read_pod(in, version) || magic != geometry_cache_magic || version != geometry_cache_version)
+        return false;
+    if (!read_pod(in, cached_key) || !(cached_key == key))
+        return false;
+
+    uint64_t mat_file_count = 0, mesh_count = 0;
+    glm::vec3 cached_centroid;
+    float cached_radius;
+    uint64_t cached_source_mesh_count = 0, cached_bytes_saved = 0;
+    vertex_cache_stats cached_before, cached_after;
+    if (!read_pod(in, cached_centroid) || !read_pod(in, cached_radius) || !read_pod(in, mat_file_count) ||
+        !read_pod(in, cached_source_mesh_count) || !read_pod(in, cached_bytes_saved) || !read_pod(in, cached_before) || !read_pod(in, cached_after))
+        return false;
+
+    //every mat file and mesh takes at least its length fields, larger counts can only come from a corrupt file
+    if (mat_file_count > bytes_left(in) / sizeof(uint64_t))
+        return false;
+
+    std::vector<std::string> cached_mat_files(mat_file_count);
+    for (auto& mat_file : cached_mat_files) {
+        if (!read_string(in, mat_file))
+            return false;
+    }
+
+    if (!read_pod(in, mesh_count) || mesh_count > bytes_left(in) / (5 * sizeof(uint64_t)))
+        return false;
+
+    //indices and lod ranges are used without further checks by the sorter and the gpu
+    std::vector<mesh> cached_meshes(mesh_count);
+    for (auto& cur_mesh : cached_meshes) {
+        if (!read_string(in, cur_mesh.mat_name) || !read_pod(in, cur_mesh.bounds_center) || !read_pod(in, cur_mesh.bounds_radius) ||
+            !read_vector(in, cur_mesh.mesh_vertices) || !read_vector(in, cur_mesh.mesh_indices) || !read_vector(in, cur_mesh.lods) ||
+            !read_vector(in, cur_mesh.instance_transforms))
+            return false;
+
+        for (auto index : cur_mesh.mesh_indices) {
+            if (index >= cur_mesh.mesh_vertices.size())
+                return false;
+        }
+        for (auto& lod : cur_mesh.lods) {
+            if (static_cast<uint64_t>(lod.index_offset) + lod.index_count > cur_mesh.mesh_indices.size())
+                return false;
+        }
+    }
+
+    std::vector<std::shared_ptr<mat_file_load>> mat_loads;
+    for (auto& mat_file : cached_mat_files)
+        mat_loads.push_back(load_mat_file(mat_file));
+    finish_mat_files(mat_loads);
+
+    for (auto& cur_mesh : cached_meshes) {
+        if (!cur_mesh.mat_name.empty())
+            cur_mesh.mesh_mat = &materials[cur_mesh.mat_name];
+    }
+
+    mat_files = std::move(cached_mat_files);
+    meshes = std::move(cached_meshes);
+    centroid = cached_centroid;
+    radius = cached_radius;
+    source_mesh_count = cached_source_mesh_count;
+    instancing_bytes_saved = cached_bytes_saved;
+    cache_before = cached_before;
+    cache_after = cached_after;
+
+    return true;
+}
+
+//written next to the cache and renamed over it once complete, a crash mid write never leaves a cache that reads as valid
+void model::write_cache(const std::string& cache_path, const geometry_cache_key& key) const {
+    std::string temp_path = cache_path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out) {
+        std::cout << "failed to write geometry cache: " << cache_path << std::endl;
+        return;
+    }
+
+    write_pod(out, geometry_cache_magic);
+    write_pod(out, geometry_cache_version);
+    write_pod(out, key);
+    write_pod(out, centroid);
+    write_pod(out, radius);
+
+    write_pod(out, static_cast<uint64_t>(mat_files.size()));
+    write_pod(out, static_cast<uint64_t>(source_mesh_count));
+    write_pod(out, static_cast<uint64_t>(instancing_bytes_saved));
+    write_pod(out, cache_before);
+    write_pod(out, cache_after);
+    for (auto& mat_file : mat_files)
+        write_string(out, mat_file);
+
+    write_pod(out, static_cast<uint64_t>(meshes.size()));
+    for (auto& cur_mesh : meshes) {
+        write_string(out, cur_mesh.mat_name);
+        write_pod(out, cur_mesh.bounds_center);
+        write_pod(out, cur_mesh.bounds_radius);
+        write_vector(out, cur_mesh.mesh_vertices);
+        write_vector(out, cur_mesh.mesh_indices);
+        write_vector(out, cur_mesh.lods);
+        write_vector(out, cur_mesh.instance_transforms);
+    }
+
+    out.close();
+    std::error_code ec;
+    if (out)
+        std::filesystem::rename(temp_path, cache_path, ec);
+    if (!out || ec) {
+        std::filesystem::remove(temp_path, ec);
+        std::cout << "failed to write geometry cache: " << cache_path << std::endl;
+    }
+}
+
+void model::set_placements(const std::vector<glm::mat4>& placements) {
+    for (auto& cur_mesh : meshes)
+        cur_mesh.set_placements(placements);
+}
+
+void model::upload() {
+    size_t compact_meshes = 0;
+
+    for (auto i = 0u; i < meshes.size(); ++i) {
+        if (meshes.at(i).mesh_mat == nullptr)
+            meshes.at(i).mesh_mat = &materials["default_mat"];
+
+        if (loader_opts.compact_vertices && meshes.at(i).choose_compact_format(radius * loader_opts.compact_max_position_error, loader_opts.compact_max_uv_error))
+            ++compact_meshes;
+
+        meshes.at(i).upload();
+    }
+
+    if (loader_opts.compact_vertices && compact_meshes < meshes.size()) {
+        std::cout << meshes.size() - compact_meshes << " of " << meshes.size()
+            << " meshes kept full float vertices, compact error would exceed the bound" << std::endl;
+    }
+}
+
+void model::setup_vertex_arrays() {
+    for (auto& cur_mesh : meshes)
+        cur_mesh.setup_vertex_array();
+}
+
+void model::setup() {
+    upload();
+    setup_vertex_arrays();
+}
+
+size_t model::vertex_buffer_bytes() const {
+    size_t bytes = 0;
+
+    for (auto& cur_mesh : meshes)
+        bytes += cur_mesh.vertex_buffer_bytes();
+
+    return bytes;
+}
+
+size_t model::gpu_bytes() const {
+    size_t bytes = 0;
+
+    for (auto& cur_mesh : meshes)
+        bytes += cur_mesh.gpu_bytes();
+
+    return bytes;
+}
+
+//geometry kept for sorting, lods and the cache, plus the decoded texture images
+size_t model::ram_bytes() const {
+    size_t bytes = model_vertices.size() * sizeof(glm::vec3) + model_texture_vertices.size() * sizeof(glm::vec2) + model_normals.size() * sizeof(glm::vec3);
+
+    for (auto& cur_mesh : meshes) {
+        bytes += cur_mesh.mesh_vertices.size() * sizeof(vertex) + cur_mesh.mesh_indices.size() * sizeof(unsigned int);
+        bytes += (cur_mesh.instance_transforms.size() + cur_mesh.draw_transforms.size()) * sizeof(glm::mat4);
+    }
+
+    for (auto& entry : materials) {
+        const mat& cur_mat = entry.second;
+        if (cur_mat.kd_data)
+            bytes += static_cast<size_t>(cur_mat.kd_width) * cur_mat.kd_height * cur_mat.kd_nr_channels;
+        if (cur_mat.ks_data)
+            bytes += static_cast<size_t>(cur_mat.ks_width) * cur_mat.ks_height * cur_mat.ks_nr_channels;
+    }
+
+    return bytes;
+}
+
+//picks the coarsest lod whose simplification error projects to less than max_pixel_error pixels
+void model::select_lods(const glm::mat4& model_matrix, const glm::vec3& eye, float pixels_per_unit, float max_pixel_error) {
+    float scale = glm::length(glm::vec3(model_matrix[0]));
+
+    for (auto& cur_mesh : meshes) {
+        //the nearest instance decides, all instances share one draw
+        float distance = FLT_MAX;
+        for (auto& instance : cur_mesh.draw_transforms) {
+            glm::vec3 center(model_matrix * instance * glm::vec4(cur_mesh.bounds_center, 1.0f));
+            distance = std::min(distance, glm::length(eye - center) - cur_mesh.bounds_radius * scale);
+        }
+        distance = std::max(distance, 0.001f);
+
+        cur_mesh.cur_lod = 0;
+        for (auto i = 1u; i < cur_mesh.lods.size(); ++i) {
+            if (cur_mesh.lods[i].error * scale / distance * pixels_per_unit > max_pixel_error)
+                break;
+            cur_mesh.cur_lod = i;
+        }
+    }
+}
+
+std::vector<size_t> model::lod_triangle_counts() const {
+    std::vector<size_t> counts;
+
+    //meshes with fewer levels keep drawing their coarsest one
+    for (auto& cur_mesh : meshes) {
+        if (counts.size() < cur_mesh.lods.size())
+            counts.resize(cur_mesh.lods.size(), 0);
+    }
+
+    for (auto& cur_mesh : meshes) {
+        for (auto i = 0u; i < counts.size(); ++i)
+            counts[i] += cur_mesh.lods[std::min(i, static_cast<unsigned int>(cur_mesh.lods.size()) - 1)].index_count / 3 * cur_mesh.draw_transforms.size();
+    }
+
+    return counts;
+}
+
+size_t model::selected_triangle_count() const {
+    size_t count = 0;
+
+    for (auto& cur_mesh : meshes)
+        count += cur_mesh.lods.at(cur_mesh.cur_lod).index_count / 3 * cur_mesh.draw_transforms.size();
+
+    return count;
 }
 
-void model::draw(Shader& shader) {
+bool model::has_translucent() const {
+    for (auto& cur_mesh : meshes) {
+        if (cur_mesh.mesh_mat->translucent)
+            return true;
+    }
+
+    return false;
+}
+
+//draws either the opaque or the translucent meshes
+void model::draw(Shader& shader, bool translucent) {
     for (auto i = 0; i < meshes.size(); ++i) {
-        meshes.at(i).draw(shader);
+        if (meshes.at(i).mesh_mat->translucent == translucent)
+            meshes.at(i).draw(shader);
+    }
+}
+
+//hands the triangles parsed since the last chunk to stream once there are enough of them, or all of them at the end
+void model::stream_parsed(parse_stream& stream, size_t& streamed_mesh, size_t& streamed_vertex, size_t bytes_parsed, size_t total_bytes, bool last) {
+    size_t unstreamed = 0;
+    for (auto i = streamed_mesh; i < meshes.size(); ++i)
+        unstreamed += meshes[i].mesh_vertices.size() - (i == streamed_mesh ? streamed_vertex : 0);
+
+    std::vector<vertex> chunk;
+    if (unstreamed >= stream.chunk_triangles * 3 || (last && unstreamed > 0)) {
+        chunk.reserve(unstreamed);
+        for (; streamed_mesh < meshes.size(); ++streamed_mesh, streamed_vertex = 0) {
+            const std::vector<vertex>& parsed = meshes[streamed_mesh].mesh_vertices;
+            chunk.insert(chunk.end(), parsed.begin() + streamed_vertex, parsed.end());
+        }
+        streamed_mesh = meshes.size() - 1;
+        streamed_vertex = meshes.back().mesh_vertices.size();
     }
+
+    stream.publish(std::move(chunk), bytes_parsed, total_bytes);
 }
 
-model::model(const std::string& model_file_path) {
-    materials.clear();
-    std::ifstream model_file(model_file_path);
+//upload = false only parses and processes, setup() has to run later on the thread that owns the gl context.
+//a stream gets the triangles while the file is parsed, files read from the geometry cache are not streamed
+model::model(const std::string& model_file_path, bool upload, parse_stream* stream) : file_path(model_file_path) {
     std::string model_file_line;
     parent_dir = std::filesystem::path(model_file_path).parent_path().string() + '/';
     bool first_mesh = true;
     model_ac = glm::vec3(0.0f); model_area = 0.0f; centroid = glm::vec3(0.0f);
     radius = 0.0f;
+    source_mesh_count = 0; instancing_bytes_saved = 0;
+
+    geometry_cache_key cache_key = make_cache_key(model_file_path, loader_opts.cache_flags());
+    if (loader_opts.use_cache && read_cache(cache_path_for(model_file_path), cache_key)) {
+        if (upload)
+            setup();
+        return;
+    }
 
+    //lines are parsed as the leading chunks of the file come in, mtl files start reading when they are named
+    std::shared_ptr<asset_file> model_file = assets().read(model_file_path, true);
+    std::vector<std::shared_ptr<mat_file_load>> mat_loads;
     meshes.emplace_back(mesh());
 
-    while (getline(model_file, model_file_line)) {
+    size_t bytes_parsed = 0, line_count = 0, streamed_mesh = 0, streamed_vertex = 0;
+
+    while (read_line(model_file, bytes_parsed, model_file_line)) {
+        if (stream && ++line_count % 65536 == 0)
+            stream_parsed(*stream, streamed_mesh, streamed_vertex, bytes_parsed, model_file->size(), false);
+
         if (model_file_line.empty())
             continue;
         size_t line_index = 0;
@@ -715,7 +1798,8 @@ model::model(const std::string& model_file_path) {
             unroll_face(model_file_line, line_index);
         }
         else if (line_type == "mtllib") {
-            parse_mat_file(get_file_path(model_file_line, line_index));
+            mat_files.push_back(get_file_path(model_file_line, line_index));
+            mat_loads.push_back(load_mat_file(mat_files.back()));
         }
         else if (line_type == "usemtl") {
             std::string mat_name;
@@ -730,13 +1814,33 @@ model::model(const std::string& model_file_path) {
             if (first_mesh) {
                 first_mesh = false;
                 meshes.back().mesh_mat = &materials[mat_name];
+                meshes.back().mat_name = mat_name;
                 continue;
             }
 
             meshes.push_back(mesh());
 
             meshes.back().mesh_mat = &materials[mat_name];
+            meshes.back().mat_name = mat_name;
         }
     }
-    setup();
+
+    if (stream)
+        stream_parsed(*stream, streamed_mesh, streamed_vertex, bytes_parsed, model_file->size(), true);
+
+    //a read that failed part way ends the loop early, what was parsed is kept but never cached
+    jobs().wait(model_file->ready);
+    bool read_whole = model_file->ok();
+    if (!read_whole)
+        std::cout << "failed to read " << model_file_path << " after " << bytes_parsed << " bytes" << std::endl;
+    model_file.reset();
+
+    finish_mat_files(mat_loads);
+    process();
+
+    if (loader_opts.use_cache && read_whole)
+        write_cache(cache_path_for(model_file_path), cache_key);
+
+    if (upload)
+        setup();
 }
\ No newline at end of file
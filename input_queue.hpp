@@ -0,0 +1,153 @@
+#ifndef INPUT_QUEUE_HPP
+#define INPUT_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <condition_variable>
+
+// the window thread only handles events and the render thread owns the gl context. input crosses over
+// as timestamped events in a lock-free single producer single consumer ring, the mutex and condition
+// variable are only there so an idle render thread can sleep until the next event
+
+//one slot stays empty to tell a full ring from an empty one. head is only written by the consumer and tail
+//only by the producer, each on its own cache line
+template <typename T, size_t capacity>
+class spsc_queue {
+public:
+    spsc_queue() : head(0), tail(0) {}
+
+    //false when full
+    bool push(const T& item) {
+        size_t cur_tail = tail.load(std::memory_order_relaxed);
+        size_t next = (cur_tail + 1) % capacity;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[cur_tail] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t cur_head = head.load(std::memory_order_relaxed);
+        if (cur_head == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[cur_head]);
+        head.store((cur_head + 1) % capacity, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, capacity> slots;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+enum viewer_event_type {
+    camera_rotate, //dx, dy in degrees
+    camera_zoom, //dy in scroll steps
+    drag_begin,
+    drag_end,
+    window_resize, //width, height
+    window_refresh,
+    load_model, //path
+    cycle_transparency_mode,
+    toggle_temporal_peeling,
+    toggle_compact_vertices,
+    quit_viewer
+};
+
+class viewer_event {
+public:
+    viewer_event_type type;
+    double time; //glfwGetTime when the window thread received it
+    float dx, dy;
+    int width, height;
+    std::string path;
+
+    viewer_event() : type(quit_viewer), time(0.0), dx(0.0f), dy(0.0f), width(0), height(0) {}
+    viewer_event(viewer_event_type type, double time) : type(type), time(time), dx(0.0f), dy(0.0f), width(0), height(0) {}
+};
+
+//at 1 kHz input the ring holds four seconds of events the render thread has not picked up. when it is full,
+//for example while the render thread is stuck in a long frame, events wait in a backlog that only the window
+//thread touches. camera deltas merge into the last held back event of their kind, everything else is kept,
+//so a drag end, a load or a quit is delayed but never lost
+class viewer_event_queue {
+public:
+    void post(const viewer_event& event) {
+        flush();
+        if (backlog.empty() && events.push(event)) {
+            notify();
+            return;
+        }
+
+        if (!backlog.empty() && mergeable(event) && backlog.back().type == event.type) {
+            backlog.back().dx += event.dx;
+            backlog.back().dy += event.dy;
+        }
+        else {
+            backlog.push_back(event);
+        }
+    }
+
+    //moves held back events into the ring as far as they fit, true when none are left
+    bool flush() {
+        bool moved = false;
+        while (!backlog.empty() && events.push(backlog.front())) {
+            backlog.pop_front();
+            moved = true;
+        }
+        if (moved)
+            notify();
+        return backlog.empty();
+    }
+
+    //for the last events before the window thread waits on the render thread, a quit must get through
+    void flush_blocking() {
+        while (!flush())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    bool poll(viewer_event& event) {
+        return events.pop(event);
+    }
+
+    //sleeps until an event is posted, or at most timeout_seconds when that is not negative
+    void wait(double timeout_seconds) {
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        auto ready = [this]() { return !events.empty(); };
+        if (timeout_seconds < 0.0)
+            posted.wait(lock, ready);
+        else
+            posted.wait_for(lock, std::chrono::duration<double>(timeout_seconds), ready);
+    }
+
+private:
+    spsc_queue<viewer_event, 4096> events;
+    std::deque<viewer_event> backlog; //window thread only
+    std::mutex wait_mutex;
+    std::condition_variable posted;
+
+    static bool mergeable(const viewer_event& event) {
+        return event.type == camera_rotate || event.type == camera_zoom;
+    }
+
+    //taking the lock orders the push before a waiting consumer's check, so the wakeup cannot be lost
+    void notify() {
+        { std::lock_guard<std::mutex> lock(wait_mutex); }
+        posted.notify_one();
+    }
+};
+
+#endif
@@ -0,0 +1,490 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+// one pool of worker threads for all loading and preprocessing work. every worker has its own deque:
+// jobs it spawns go to the back and it takes from the back, idle workers steal the oldest job from the
+// front of another deque. jobs may depend on other jobs and only get queued once those are done.
+// pinned jobs never run on a worker, they wait for the thread that spawned them to wait on something,
+// which is how work that needs that thread's gl context fits into a graph. background jobs, and every job
+// they spawn, only run on workers that have nothing else to do, so prefetching never holds up a load.
+// a job that throws still counts as done for the jobs depending on it, the exception comes out of wait.
+// with tracing on every job is recorded with the lane it ran on, write_trace saves a chrome://tracing file
+
+class job {
+public:
+    const char* name;
+    std::function<void()> work;
+    bool pinned;
+    bool background;
+    std::thread::id owner; //the only thread that runs a pinned job
+    std::atomic<int> unfinished; //dependencies not done yet, plus one while the job is being spawned
+
+    job(const char* name, std::function<void()> work, bool pinned, bool background) : name(name), work(std::move(work)), pinned(pinned), background(background),
+        owner(std::this_thread::get_id()), unfinished(1), done(false) {
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return done;
+    }
+
+private:
+    friend class job_system;
+    std::mutex mutex;
+    bool done;
+    std::exception_ptr error; //what work threw, set before done
+    std::vector<std::shared_ptr<job>> continuations;
+};
+
+typedef std::shared_ptr<job> job_handle;
+
+//lane of the calling thread, workers are 0 to n - 1 and other threads get the lanes after them once they need one
+thread_local int job_lane = -1;
+thread_local bool job_worker = false;
+thread_local bool job_background = false; //the job running on this thread is a background job
+thread_local double job_nested_us = 0.0; //traced time of jobs run inside the one running on this thread
+
+class job_system {
+public:
+    job_system(size_t worker_count);
+    ~job_system();
+
+    job_handle spawn(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies = {});
+    job_handle spawn_pinned(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies = {});
+    job_handle spawn_background(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies = {});
+    job_handle spawn_event(const char* name);
+    void signal(const job_handle& event);
+    void wait(const job_handle& handle);
+    void wait(const std::vector<job_handle>& handles);
+    void parallel_for(const char* name, size_t count, size_t grain, const std::function<void(size_t)>& body);
+    size_t worker_count() const { return threads.size(); }
+
+    void enable_trace();
+    bool write_trace(const std::string& path);
+    std::string occupancy();
+
+    job_system(const job_system&) = delete;
+    job_system& operator=(const job_system&) = delete;
+
+private:
+    class job_queue {
+    public:
+        std::mutex mutex;
+        std::deque<job_handle> jobs;
+    };
+
+    class trace_event {
+    public:
+        const char* name;
+        int lane;
+        double start_us, end_us;
+        double own_us; //without the jobs it ran while it waited
+    };
+
+    std::vector<std::unique_ptr<job_queue>> queues; //one per worker, the last one takes jobs spawned outside the pool
+    job_queue background_queue;
+    std::vector<std::thread> threads;
+    std::mutex sleep_mutex;
+    std::condition_variable wake, finished;
+    std::atomic<size_t> queued;
+    bool stopping;
+
+    std::mutex pinned_mutex;
+    std::vector<job_handle> pinned;
+
+    std::atomic<bool> tracing;
+    std::atomic<int> next_lane;
+    std::mutex trace_mutex;
+    std::vector<trace_event> trace;
+    std::chrono::steady_clock::time_point trace_start;
+
+    job_handle create(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies, bool pinned_job, bool background_job);
+    void schedule(const job_handle& ready);
+    job_handle take(int worker, bool allow_background);
+    bool run_pinned();
+    void execute(const job_handle& running);
+    double record(const char* name, std::chrono::steady_clock::time_point start);
+    int lane();
+};
+
+job_system::job_system(size_t worker_count) : queued(0), stopping(false), tracing(false), next_lane(static_cast<int>(worker_count)) {
+    for (auto i = 0u; i <= worker_count; ++i)
+        queues.push_back(std::make_unique<job_queue>());
+
+    for (auto w = 0u; w < worker_count; ++w) {
+        threads.emplace_back([this, w]() {
+            job_lane = static_cast<int>(w);
+            job_worker = true;
+
+            while (true) {
+                job_handle next = take(static_cast<int>(w), true);
+                if (next != nullptr) {
+                    execute(next);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this]() { return stopping || queued > 0; });
+                if (stopping && queued == 0)
+                    return;
+            }
+        });
+    }
+}
+
+//jobs still queued are run before the workers stop
+job_system::~job_system() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& t : threads)
+        t.join();
+}
+
+job_handle job_system::create(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies, bool pinned_job, bool background_job) {
+    job_handle created = std::make_shared<job>(name, std::move(work), pinned_job, background_job || job_background);
+
+    for (auto& dependency : dependencies) {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (!dependency->done) {
+            ++created->unfinished;
+            dependency->continuations.push_back(created);
+        }
+    }
+
+    //dependencies that finish while they are being added cannot queue the job early, the extra count holds it back
+    if (--created->unfinished == 0)
+        schedule(created);
+
+    return created;
+}
+
+job_handle job_system::spawn(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies) {
+    return create(name, std::move(work), dependencies, false, false);
+}
+
+//runs on the calling thread once its dependencies are done and that thread waits on anything
+job_handle job_system::spawn_pinned(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies) {
+    return create(name, std::move(work), dependencies, true, false);
+}
+
+job_handle job_system::spawn_background(const char* name, std::function<void()> work, const std::vector<job_handle>& dependencies) {
+    return create(name, std::move(work), dependencies, false, true);
+}
+
+//stands for work done outside the pool, like a file read, it finishes when signal is called and jobs can depend on it
+job_handle job_system::spawn_event(const char* name) {
+    return std::make_shared<job>(name, []() {}, false, false);
+}
+
+void job_system::signal(const job_handle& event) {
+    if (--event->unfinished == 0)
+        execute(event);
+}
+
+void job_system::schedule(const job_handle& ready) {
+    if (ready->pinned) {
+        {
+            std::lock_guard<std::mutex> lock(pinned_mutex);
+            pinned.push_back(ready);
+        }
+        { std::lock_guard<std::mutex> lock(sleep_mutex); }
+        finished.notify_all();
+        return;
+    }
+
+    //counted before it is pushed, so a worker taking it right away never sees the count below zero
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        ++queued;
+    }
+
+    job_queue& queue = ready->background ? background_queue : *queues[job_worker ? job_lane : queues.size() - 1];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(ready);
+    }
+    wake.notify_one();
+}
+
+//newest job of the own deque first, it is the one whose data is still in cache, then the oldest of anyone else,
+//background jobs only when there is nothing else
+job_handle job_system::take(int worker, bool allow_background) {
+    for (auto i = 0u; i < queues.size(); ++i) {
+        size_t victim = (worker + i) % queues.size();
+        job_queue& queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            continue;
+
+        job_handle next;
+        if (i == 0) {
+            next = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else {
+            next = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+
+        --queued;
+        return next;
+    }
+
+    if (allow_background) {
+        std::lock_guard<std::mutex> lock(background_queue.mutex);
+        if (!background_queue.jobs.empty()) {
+            job_handle next = std::move(background_queue.jobs.front());
+            background_queue.jobs.pop_front();
+            --queued;
+            return next;
+        }
+    }
+
+    return nullptr;
+}
+
+bool job_system::run_pinned() {
+    job_handle next;
+    {
+        std::lock_guard<std::mutex> lock(pinned_mutex);
+        auto it = std::find_if(pinned.begin(), pinned.end(), [](const job_handle& j) { return j->owner == std::this_thread::get_id(); });
+        if (it == pinned.end())
+            return false;
+
+        next = std::move(*it);
+        pinned.erase(it);
+    }
+
+    execute(next);
+    return true;
+}
+
+void job_system::execute(const job_handle& running) {
+    bool outer_background = job_background;
+    double outer_nested = job_nested_us;
+    job_background = running->background;
+    job_nested_us = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    std::exception_ptr error;
+    try {
+        running->work();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    running->work = nullptr;
+    job_background = outer_background;
+    job_nested_us = outer_nested + (tracing ? record(running->name, start) : 0.0);
+
+    //the jobs depending on a failed one still run, they check their inputs themselves
+    std::vector<job_handle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(running->mutex);
+        running->error = error;
+        running->done = true;
+        continuations.swap(running->continuations);
+    }
+
+    for (auto& continuation : continuations) {
+        if (--continuation->unfinished == 0)
+            schedule(continuation);
+    }
+
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    finished.notify_all();
+}
+
+//rethrows what the job threw. workers run other jobs while they wait, any other thread only runs its own pinned jobs and sleeps otherwise.
+//a job that waits never picks up a background job unless it is one itself, a load waiting on its own mtl
+//files would otherwise sit inside the parse of a prefetched neighbour until that is done
+void job_system::wait(const job_handle& handle) {
+    while (!handle->finished()) {
+        if (run_pinned())
+            continue;
+        if (job_worker) {
+            job_handle next = take(job_lane, job_background);
+            if (next != nullptr) {
+                execute(next);
+                continue;
+            }
+        }
+
+        //a short timeout instead of a predicate, a job queued for a waiting worker does not notify this variable
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        finished.wait_for(lock, std::chrono::milliseconds(1));
+    }
+
+    if (handle->error)
+        std::rethrow_exception(handle->error);
+}
+
+//every job is waited for before the first exception is rethrown, the others may still use the caller's data
+void job_system::wait(const std::vector<job_handle>& handles) {
+    std::exception_ptr first;
+    for (auto& handle : handles) {
+        try {
+            wait(handle);
+        }
+        catch (...) {
+            if (!first)
+                first = std::current_exception();
+        }
+    }
+
+    if (first)
+        std::rethrow_exception(first);
+}
+
+//grain indices are handed out at a time. the caller works through them as well and never runs unrelated jobs,
+//so a render thread sorting on the pool is not held up by a model that is loading. helpers that only start
+//once every index is taken return without touching body. the first exception body throws is rethrown once
+//every index is done, the rest of its range is skipped
+void job_system::parallel_for(const char* name, size_t count, size_t grain, const std::function<void(size_t)>& body) {
+    grain = std::max<size_t>(grain, 1);
+    size_t ranges = (count + grain - 1) / grain;
+    if (ranges == 0)
+        return;
+
+    class loop_state {
+    public:
+        std::atomic<size_t> next{ 0 }, done{ 0 };
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<loop_state> state = std::make_shared<loop_state>();
+    const std::function<void(size_t)>* loop_body = &body;
+
+    auto run_ranges = [state, count, grain, loop_body]() {
+        for (size_t begin = state->next.fetch_add(grain); begin < count; begin = state->next.fetch_add(grain)) {
+            size_t end = std::min(count, begin + grain);
+            try {
+                for (size_t i = begin; i < end; ++i)
+                    (*loop_body)(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+            state->done += end - begin;
+        }
+    };
+
+    size_t helpers = std::min(threads.size(), ranges - 1);
+    for (auto h = 0u; h < helpers; ++h)
+        spawn(name, run_ranges);
+
+    //inside a job the loop shows up nested in it and is taken out of that job's own time
+    double outer_nested = job_nested_us;
+    job_nested_us = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    run_ranges();
+    job_nested_us = outer_nested + (tracing ? record(name, start) : 0.0);
+
+    //the rest is only what helpers are still working on
+    while (state->done < count)
+        std::this_thread::yield();
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+void job_system::enable_trace() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace.clear();
+    trace_start = std::chrono::steady_clock::now();
+    tracing = true;
+}
+
+int job_system::lane() {
+    if (job_lane < 0)
+        job_lane = next_lane++;
+    return job_lane;
+}
+
+//returns the traced time, the caller adds it to the nested time of whatever runs around it
+double job_system::record(const char* name, std::chrono::steady_clock::time_point start) {
+    auto end = std::chrono::steady_clock::now();
+    int cur_lane = lane();
+    double start_us = std::chrono::duration<double, std::micro>(start - trace_start).count();
+    double end_us = std::chrono::duration<double, std::micro>(end - trace_start).count();
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace.push_back({ name, cur_lane, start_us, end_us, std::max(end_us - start_us - job_nested_us, 0.0) });
+    return end_us - start_us;
+}
+
+//lanes past the workers are threads outside the pool
+bool job_system::write_trace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    out << std::fixed << std::setprecision(1) << "{\"traceEvents\":[\n";
+    for (auto i = 0u; i < trace.size(); ++i) {
+        const trace_event& event = trace[i];
+        out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.lane
+            << ",\"ts\":" << event.start_us << ",\"dur\":" << event.end_us - event.start_us << "}" << (i + 1 < trace.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+
+    return static_cast<bool>(out);
+}
+
+//busy time of every lane over the span from the first job to the last, nested jobs only count once
+std::string job_system::occupancy() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    std::vector<double> busy;
+    std::vector<size_t> counts;
+    double first = trace.empty() ? 0.0 : trace.front().start_us, last = 0.0;
+
+    for (auto& event : trace) {
+        if (busy.size() <= static_cast<size_t>(event.lane)) {
+            busy.resize(event.lane + 1, 0.0);
+            counts.resize(event.lane + 1, 0);
+        }
+        busy[event.lane] += event.own_us;
+        ++counts[event.lane];
+        first = std::min(first, event.start_us);
+        last = std::max(last, event.end_us);
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    double span = std::max(last - first, 1.0);
+    for (auto i = 0u; i < busy.size(); ++i) {
+        out << (i < threads.size() ? "worker " : "caller ") << i << ": " << busy[i] / span * 100.0 << "% busy, "
+            << counts[i] << " jobs\n";
+    }
+
+    return out.str();
+}
+
+job_system& jobs() {
+    static job_system instance(std::max(1u, std::thread::hardware_concurrency()));
+    return instance;
+}
+
+#endif
@@ -2,51 +2,117 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
 #include <windows.h>
 #include <filesystem>
+#include <thread>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "shader.hpp"
 #include "cam.hpp"
 #include "hamood_obj_loader.hpp"
-
-
+#include "scene.hpp"
+#include "stats.hpp"
+#include "render_target.hpp"
+#include "renderer.hpp"
+#include "quality_governor.hpp"
+#include "benchmark.hpp"
+#include "input_queue.hpp"
+#include "scene_loader.hpp"
+#include "stream_preview.hpp"
+
+
+//window thread state, the render thread only learns about input through events
 int window_width = 1000, window_height = 1000;
-float yaw = 0.0f, pitch = 0.0f;
 double last_x, last_y;
 bool left_button_pressed = false;
 bool input_button_pressed = false;
-bool swap_model = false;
-unsigned int prev_depth, color_attachment, cur_depth;
+viewer_event_queue events;
+spsc_queue<std::string, 8> titles; //render thread to window thread
 int layers = 10;
+float fov = 90.0f;
+float lod_pixel_error = 1.0f;
+float frame_budget_ms = 16.6f; //frame time the governor holds while dragging, --frame-budget <ms>
+size_t cache_vram_mb = 512; //scenes kept set up on the gpu after switching away, --cache-vram <MB>
+size_t prefetch_ram_mb = 1024; //neighbouring files parsed ahead, --prefetch-ram <MB>
+size_t prefetch_neighbours = 2;
+size_t stream_min_mb = 256; //obj files at least this large are drawn while they parse
+size_t stream_chunk_triangles = 1000000;
+std::string job_trace_path; //every loading job of the session as a chrome://tracing file, --job-trace <file>
 OPENFILENAMEA f = { sizeof(OPENFILENAMEA) };
-unsigned int peel_depths[2];
-std::vector<unsigned int> color_attachments(layers);
 std::string model_name = std::filesystem::current_path().parent_path().string() + "/default_model/bunny.obj";
-std::string main_shader_vs_path = std::filesystem::current_path().parent_path().string() + "/shaders/shader.vs";
-std::string main_shader_fs_path = std::filesystem::current_path().parent_path().string() + "/shaders/shader.fs";
+std::string shader_dir = std::filesystem::current_path().parent_path().string() + "/shaders";
 std::string button_shader_vs = std::filesystem::current_path().parent_path().string() + "/shaders/input_button_shader.vs";
 std::string button_shader_fs = std::filesystem::current_path().parent_path().string() + "/shaders/input_button_shader.fs";
-std::string screen_shader_vs = std::filesystem::current_path().parent_path().string() + "/shaders/screen.vs";
-std::string screen_shader_fs = std::filesystem::current_path().parent_path().string() + "/shaders/screen.fs";
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 GLFWwindow* glfwSetup();
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_refresh_callback(GLFWwindow* window);
+void post_event(viewer_event_type type);
+bool parse_option(const char* text, float& value);
+bool parse_option(const char* text, size_t& value);
 
 orbit_camera orbit_cam(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 3.0f, 0.0f, 0.0f);
 
-int main() {
+int main(int argc, char** argv) {
     GLFWwindow* window = glfwSetup();
 
-    Shader main_shader(main_shader_vs_path.c_str(), main_shader_fs_path.c_str());
+    renderer view_renderer(shader_dir, window_width, window_height, layers);
     Shader input_button_shader(button_shader_vs.c_str(), button_shader_fs.c_str());
-    Shader screen_shader(screen_shader_vs.c_str(), screen_shader_fs.c_str());
-    model m(model_name.c_str());
+
+    //--bench-transparency <obj or scene> renders a fixed set of views in every transparency mode and exits
+    if (argc >= 3 && std::string(argv[1]) == "--bench-transparency") {
+        scene bench_scene(argv[2]);
+        run_transparency_benchmark(view_renderer, bench_scene, fov, 8, 20);
+        glfwTerminate();
+        return 0;
+    }
+
+    //--bench-vertex-reuse <obj or scene> times front to back peeling with and without the transform feedback pre-pass
+    if (argc >= 3 && std::string(argv[1]) == "--bench-vertex-reuse") {
+        scene bench_scene(argv[2]);
+        run_vertex_reuse_benchmark(view_renderer, bench_scene, fov, 20);
+        glfwTerminate();
+        return 0;
+    }
+
+    //--bench-composite times the layer composite at 1080p and 4k against the old one draw per layer composite
+    if (argc >= 2 && std::string(argv[1]) == "--bench-composite") {
+        run_composite_benchmark(view_renderer, shader_dir, 100);
+        glfwTerminate();
+        return 0;
+    }
+
+    for (auto i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        bool parsed = true;
+        if (option == "--frame-budget")
+            parsed = parse_option(argv[i + 1], frame_budget_ms);
+        else if (option == "--cache-vram")
+            parsed = parse_option(argv[i + 1], cache_vram_mb);
+        else if (option == "--prefetch-ram")
+            parsed = parse_option(argv[i + 1], prefetch_ram_mb);
+        else if (option == "--job-trace")
+            job_trace_path = argv[i + 1];
+
+        if (!parsed) {
+            std::cout << "ignoring " << option << ' ' << argv[i + 1] << ", keeping the default\n"
+                << "usage: 3DObjViewer [--frame-budget <ms>] [--cache-vram <MB>] [--prefetch-ram <MB>] [--job-trace <file>]\n";
+        }
+    }
+    if (!job_trace_path.empty())
+        jobs().enable_trace();
+    quality_governor governor(frame_budget_ms);
+
+    scene s(model_name);
     //modeler mer(model_name);
-    f.lpstrFilter = "obj files\0*.obj\0";
+    f.lpstrFilter = "obj files\0*.obj\0scene files\0*.scene\0";
     f.lpstrTitle = "Select Obj File";
     char buff[MAX_PATH] = {};
     f.nMaxFile = sizeof(buff);
@@ -61,27 +127,6 @@ int main() {
         -0.7, 0.8, 0, 1, 0
     };
 
-    float quad_vertices[] = {
-        -1.0f,  1.0f,  0.0f, 1.0f,
-        -1.0f, -1.0f,  0.0f, 0.0f,
-         1.0f, -1.0f,  1.0f, 0.0f,
-
-        -1.0f,  1.0f,  0.0f, 1.0f,
-         1.0f, -1.0f,  1.0f, 0.0f,
-         1.0f,  1.0f,  1.0f, 1.0f
-    };
-
-    unsigned int quad_VAO, quad_VBO;
-    glGenVertexArrays(1, &quad_VAO);
-    glGenBuffers(1, &quad_VBO);
-    glBindVertexArray(quad_VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, quad_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
-
     unsigned int input_button_vao, input_button_vbo;
     glGenVertexArrays(1, &input_button_vao); glGenBuffers(1, &input_button_vbo);
     glBindVertexArray(input_button_vao); glBindBuffer(GL_ARRAY_BUFFER, input_button_vbo);
@@ -112,162 +157,380 @@ int main() {
     glBindTexture(GL_TEXTURE_2D, input_button_texture);
     input_button_shader.setInt("button_tex", 0);
 
-    unsigned int depth_peeling_FBO;
-    glGenFramebuffers(1, &depth_peeling_FBO);
-    glGenTextures(1, &prev_depth); glGenTextures(1, &cur_depth);
-    glBindFramebuffer(GL_FRAMEBUFFER, depth_peeling_FBO);
-
-    glGenTextures(layers, color_attachments.data());
-    for (int i = 0; i < layers; ++i) {
-        glBindTexture(GL_TEXTURE_2D, color_attachments[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, window_width, window_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    }
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_attachments[0], 0);
-    glGenTextures(2, peel_depths);
-
-    for (int i = 0; i < 2; ++i) {
-        glBindTexture(GL_TEXTURE_2D, peel_depths[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, window_width, window_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    //models load on a hidden window sharing objects with this context, windows can only be made on this thread
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* upload_window = glfwCreateWindow(1, 1, "", NULL, window);
+    if (upload_window == NULL) {
+        std::cout << "GLFW upload context creation failed\n";
+        glfwTerminate();
+        return -1;
     }
 
-    while (!glfwWindowShouldClose(window)) {
-        bool first_pass = true;
+    //the context moves to the render thread, the window thread only waits for events from here on
+    int frame_width = window_width, frame_height = window_height;
+    glfwMakeContextCurrent(NULL);
+
+    std::thread render_thread([&]() {
+        glfwMakeContextCurrent(window);
+
+        //everything in here deletes gl objects when it goes, so it has to go before the context is released
+        {
+            //the last composited frame, presented again when nothing changed
+            render_target frame(frame_width, frame_height);
+            scene_loader loader(upload_window, prefetch_ram_mb << 20);
+            load_options view_options = loader_opts; //options of the next load, only the loader thread reads loader_opts
+            scene_cache resident(cache_vram_mb << 20); //scenes switched away from, still set up on the gpu
+            std::string current_key = scene_cache_key(model_name, view_options); //empty while a streamed preview is shown
+            stream_preview streaming;
+            float yaw = 0.0f, pitch = 0.0f;
+            bool dragging = false, running = true;
+            bool redraw = true; //camera, window, model or mode changed since the cached frame was rendered
+            bool present_cached = false; //the window was exposed and only needs the cached frame again
+            double oldest_input = -1.0; //time of the first input the next frame shows
+            double io_reported = 0.0; //last time the title showed the bytes in flight
+
+            auto present = [&]() {
+                frame.present(0);
+
+                input_button_shader.use();
+                glBindVertexArray(input_button_vao);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, input_button_texture);
+                input_button_shader.setInt("button_tex", 0);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+                glBindVertexArray(0);
+
+                glfwSwapBuffers(window);
+            };
+
+            //files next to the shown one are parsed ahead unless they are still set up from before
+            auto prefetch = [&]() {
+                std::vector<std::string> paths;
+                for (auto& path : neighbour_files(model_name, prefetch_neighbours)) {
+                    if (!resident.contains(scene_cache_key(path, view_options)))
+                        paths.push_back(path);
+                }
+                loader.prefetch(paths, view_options);
+            };
+
+            //the evicted scenes may have been drawn in the frames still in flight
+            auto cache_scene = [&](const std::string& key, std::unique_ptr<scene> cached) {
+                size_t bytes = cached->gpu_bytes();
+                for (auto& evicted : resident.insert(key, std::move(cached), bytes))
+                    loader.retire(std::move(evicted));
+            };
+
+            //swapped between frames, the replaced scene stays set up in the cache unless it was a preview or reloaded.
+            //an empty key swaps in the preview of a file that is still streaming
+            auto swap_in = [&](std::unique_ptr<scene> next, const std::string& key) {
+                std::swap(s, *next);
+                if (current_key.empty() || key == current_key)
+                    loader.retire(std::move(next));
+                else
+                    cache_scene(current_key, std::move(next));
+                current_key = key;
+                view_renderer.set_mode(view_renderer.mode);
+                stats.report_next();
+                redraw = true;
+
+                if (!key.empty()) {
+                    streaming.end();
+                    stats.loading.clear();
+                    stats.loading_bytes = 0; stats.loading_total_bytes = 0; stats.streamed_triangles = 0;
+                    prefetch();
+                }
+            };
+
+            prefetch();
+
+            while (running) {
+                //every event since the last frame is applied at once, camera deltas add up
+                viewer_event event;
+                while (events.poll(event)) {
+                    if (event.type == camera_rotate || event.type == camera_zoom) {
+                        if (oldest_input < 0.0)
+                            oldest_input = event.time;
+                    }
+
+                    if (event.type == camera_rotate) {
+                        yaw = std::fmod(yaw + event.dx, 360.0f);
+                        pitch = std::fmod(pitch + event.dy, 360.0f);
+                        redraw = true;
+                    }
+                    else if (event.type == camera_zoom) {
+                        orbit_cam.radius -= event.dy;
+                        if (orbit_cam.radius < 1.0f)
+                            orbit_cam.radius = 1.0f;
+                        redraw = true;
+                    }
+                    else if (event.type == drag_begin) {
+                        dragging = true;
+                    }
+                    else if (event.type == drag_end) {
+                        //the governor starts restoring quality from the next frame
+                        redraw = redraw || dragging;
+                        dragging = false;
+                    }
+                    else if (event.type == window_resize) {
+                        frame_width = event.width;
+                        frame_height = event.height;
+                        redraw = true;
+                    }
+                    else if (event.type == window_refresh) {
+                        present_cached = true;
+                    }
+                    else if (event.type == load_model || event.type == toggle_compact_vertices) {
+                        //vertex format is picked at upload, so switching it reloads the current model
+                        if (event.type == toggle_compact_vertices)
+                            view_options.compact_vertices = !view_options.compact_vertices;
+                        else
+                            model_name = event.path;
+
+                        //a scene still set up from before is swapped in right away, anything else loads in the
+                        //background while the current scene keeps being drawn
+                        std::string key = scene_cache_key(model_name, view_options);
+                        std::unique_ptr<scene> cached = resident.take(key);
+                        if (cached != nullptr) {
+                            loader.cancel();
+                            swap_in(std::move(cached), key);
+                        }
+                        else {
+                            std::shared_ptr<parse_stream> stream;
+                            std::error_code size_error;
+                            size_t file_bytes = static_cast<size_t>(std::filesystem::file_size(model_name, size_error));
+                            if (!is_scene_file(model_name) && !size_error && file_bytes >= (stream_min_mb << 20))
+                                stream = std::make_shared<parse_stream>(stream_chunk_triangles);
+
+                            streaming.begin(stream);
+                            loader.request(model_name, view_options, stream);
+                            stats.loading_bytes = 0; stats.loading_total_bytes = 0; stats.streamed_triangles = 0;
+                            stats.loading = std::filesystem::path(model_name).filename().string();
+                            stats.report_next();
+                            redraw = true;
+                        }
+                    }
+                    else if (event.type == cycle_transparency_mode) {
+                        transparency_mode next = view_renderer.mode;
+                        do {
+                            next = static_cast<transparency_mode>((next + 1) % transparency_mode_count);
+                        } while (!view_renderer.mode_supported(next));
+
+                        view_renderer.set_mode(next);
+                        redraw = true;
+                    }
+                    else if (event.type == toggle_temporal_peeling) {
+                        view_renderer.set_temporal_peeling(!view_renderer.temporal_peeling);
+                        redraw = true;
+                    }
+                    else if (event.type == quit_viewer) {
+                        running = false;
+                    }
+                }
+                if (!running)
+                    break;
+
+                //loads that were superseded before they finished are kept for switching back
+                loaded_scene finished;
+                while (loader.take(finished)) {
+                    if (finished.current)
+                        swap_in(std::move(finished.loaded), finished.key);
+                    else
+                        cache_scene(finished.key, std::move(finished.loaded));
+                }
+                loader.collect_retired();
+
+                //a large file shows up chunk by chunk while it parses, one chunk per loop
+                std::vector<vertex> chunk;
+                if (streaming.stream != nullptr && streaming.stream->take(chunk, streaming.bytes_parsed, streaming.total_bytes)) {
+                    if (!chunk.empty()) {
+                        if (!streaming.shown) {
+                            swap_in(streaming.create(), "");
+                            streaming.shown = true;
+                        }
+                        streaming.append(s, chunk);
+                    }
+
+                    stats.loading_bytes = streaming.bytes_parsed;
+                    stats.loading_total_bytes = streaming.total_bytes;
+                    stats.streamed_triangles = streaming.resident_triangles;
+                    stats.report_next();
+                    redraw = true;
+                }
+
+                //asset reads show in the title when files start or finish, the bytes in flight at most twice a second
+                size_t io_queue_depth = assets().queue_depth(), io_bytes_in_flight = assets().bytes_in_flight();
+                bool io_progress = io_bytes_in_flight != stats.io_bytes_in_flight && glfwGetTime() - io_reported >= 0.5;
+                if (io_queue_depth != stats.io_queue_depth || io_progress) {
+                    io_reported = glfwGetTime();
+                    stats.io_queue_depth = io_queue_depth;
+                    stats.io_bytes_in_flight = io_bytes_in_flight;
+                    stats.io_backend = assets().backend();
+                    stats.report_next();
+                    redraw = true;
+                }
+
+                //a late peel count change is the only thing that alters the image without input
+                if (!redraw && view_renderer.poll_peel_budget())
+                    redraw = true;
+
+                //quality dropped during a drag comes back over the next frames
+                if (!redraw && governor.restoring())
+                    redraw = true;
+
+                //half of the last frame was reprojected, the still view gets one exact frame
+                if (!redraw && view_renderer.reused_passes > 0)
+                    redraw = true;
+
+                if (!redraw || frame_width == 0 || frame_height == 0) {
+                    if (present_cached && frame_width > 0 && frame_height > 0)
+                        present();
+                    present_cached = false;
+
+                    //sleeps until input, only polling briefly while peel counts of the last frame are still in flight,
+                    //a load is running, files are still reading or a retired scene waits for the gpu
+                    bool polling = view_renderer.peel_results_pending() || loader.loading() || assets().queue_depth() > 0 || loader.retired_pending();
+                    events.wait(polling ? 0.01 : -1.0);
+                    continue;
+                }
+
+                stats.begin_frame();
+                redraw = false;
+                view_renderer.resize(frame_width, frame_height);
+                frame.resize(frame_width, frame_height);
+                governor.interacting = dragging;
+                governor.begin_frame();
+                glm::mat4 Model = s.framing_matrix();
+
+                orbit_cam.rotate_x(glm::radians(yaw));
+                orbit_cam.rotate_y(glm::radians(pitch));
+
+                glm::mat4 projection = glm::perspective(glm::radians(fov), (float)frame_width / (float)frame_height, 0.1f, 100.0f);
+
+                //same lod for every peel pass, otherwise layers would peel against different surfaces
+                float pixels_per_unit = frame_height / (2.0f * std::tan(glm::radians(fov) * 0.5f));
+                s.select_lods(Model, orbit_cam.get_eye(), pixels_per_unit, lod_pixel_error);
+                stats.drawn_triangles = s.selected_triangle_count();
+                stats.lod_triangles = s.lod_triangle_counts();
+                stats.unique_meshes = s.mesh_count();
+                stats.source_meshes = s.source_mesh_count();
+                stats.instancing_bytes_saved = s.instancing_bytes_saved();
+                stats.models = s.models.size();
+                stats.placements = s.placements.size();
+                stats.vertex_bytes = s.vertex_buffer_bytes();
+                stats.cached_scenes = resident.size();
+                stats.cached_bytes = resident.bytes();
+                stats.prefetched_scenes = loader.prefetched_count();
+                vertex_cache_stats cache_before, cache_after;
+                s.vertex_cache(cache_before, cache_after);
+                stats.acmr_before = cache_before.acmr;
+                stats.acmr_after = cache_after.acmr;
+
+                view_renderer.render(s, Model, orbit_cam.get_view_matrix(), projection, frame.fbo);
+                governor.end_frame(view_renderer);
+                stats.quality = governor.interacting || governor.degraded() ? governor.summary() : "";
+                stats.peel_layers = view_renderer.peel_passes;
+                stats.reused_layers = view_renderer.reused_passes;
+                stats.transparency = transparency_mode_names[view_renderer.mode];
+                stats.transparency_bytes = view_renderer.target_bytes;
+                stats.overflow_pixels = view_renderer.mode == k_buffer ? view_renderer.kbuffer_overflow_pixels : 0;
+                stats.sorted_triangles = view_renderer.mode == cpu_sorted ? view_renderer.sorter.sorted_triangles : 0;
+                stats.sort_ms = view_renderer.sorter.sort_ms;
+                stats.cleared_pixels = view_renderer.cleared_pixels;
+                stats.layer_fragments = view_renderer.layer_fragments;
+
+                yaw = 0;
+                pitch = 0;
+
+                present();
+                if (oldest_input >= 0.0)
+                    stats.input_latency_ms = (glfwGetTime() - oldest_input) * 1000.0;
+                oldest_input = -1.0;
+
+                //window functions belong to the window thread, it is woken up to set the title
+                if (stats.end_frame() && titles.push(stats.title()))
+                    glfwPostEmptyEvent();
+            }
 
-        if (swap_model) {
-            m = model(f.lpstrFile);
-            swap_model = false;
+            //cached scenes own vertex arrays of this context
+            for (auto& evicted : resident.clear())
+                loader.retire(std::move(evicted));
         }
 
-        if (window_width == 0 || window_height == 0) {
-            glfwWaitEvents();
-            continue;
-        }
-
-        glViewport(0, 0, window_width, window_height);
-
-        float scale = 2.0f / m.radius;
-        glm::mat4 Model(1.0f);
-        Model = glm::scale(Model, glm::vec3(scale));
-        Model = glm::translate(Model, -m.centroid);
-        //Model = glm::translate(Model, -true_centroid);
-
-        glEnable(GL_DEPTH_TEST);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, depth_peeling_FBO);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
-        glClearDepth(1.0f);
-        glDepthMask(GL_TRUE);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-
-        orbit_cam.rotate_x(glm::radians(yaw));
-        orbit_cam.rotate_y(glm::radians(pitch));
-
-        glm::mat4 projection = glm::perspective(glm::radians(90.0f), (float)window_width / (float)window_height, 0.1f, 100.0f);
-        main_shader.use();
+        glfwMakeContextCurrent(NULL);
+    });
 
-        main_shader.setMat4("model", Model);
-        main_shader.setMat4("view", orbit_cam.get_view_matrix());
-        main_shader.setMat4("projection", projection);
-        main_shader.setVec3("light_location", glm::vec3(0.0, 25, 0.0));
-        main_shader.setVec2("screen_size", glm::vec2(window_width, window_height));
-        main_shader.setBool("first_pass", true);
-
-
-        glDisable(GL_BLEND);
-
-        for (int i = 0; i < layers;++i) {
-            unsigned int curDepth = peel_depths[i % 2];
-            unsigned int prevDepth = peel_depths[(i + 1) % 2];
-
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_attachments[i], 0);
+    while (!glfwWindowShouldClose(window)) {
+        //events held back by a full ring are retried until the render thread makes room
+        if (events.flush())
+            glfwWaitEvents();
+        else
+            glfwWaitEventsTimeout(0.01);
 
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, curDepth, 0);
+        std::string title;
+        while (titles.pop(title))
+            glfwSetWindowTitle(window, title.c_str());
+    }
 
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    post_event(quit_viewer);
+    events.flush_blocking();
+    render_thread.join();
 
-            if (i > 0) {
-                glActiveTexture(GL_TEXTURE3);
-                glBindTexture(GL_TEXTURE_2D, prevDepth);
-                main_shader.setInt("prev_depth", 3);
-            }
+    if (!job_trace_path.empty()) {
+        if (!jobs().write_trace(job_trace_path))
+            std::cout << "failed to write job trace: " << job_trace_path << std::endl;
+        std::cout << jobs().occupancy();
+    }
 
-            main_shader.setBool("first_pass", (i == 0));
-            m.draw(main_shader);
-        }
+    glfwTerminate();
+    return 0;
+}
 
-        glEnable(GL_BLEND);
-
-        yaw = 0;
-        pitch = 0;
-
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glEnable(GL_DEPTH_TEST);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glBlendEquation(GL_FUNC_ADD);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-        glDisable(GL_DEPTH_TEST);
-        screen_shader.use();
-        glBindVertexArray(quad_VAO);
-        screen_shader.setVec2("screen_size", glm::vec2(window_width, window_height));
-
-        for (int i = layers - 1; i >= 0; --i) {
-            glActiveTexture(GL_TEXTURE5);
-            glBindTexture(GL_TEXTURE_2D, color_attachments[i]);
-            screen_shader.setInt("screenTexture", 5);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
+//callbacks run on the window thread and hand everything the render thread needs over as events
+void post_event(viewer_event_type type) {
+    events.post(viewer_event(type, glfwGetTime()));
+}
 
-        glBlendEquation(GL_FUNC_ADD);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+//the whole text has to be a positive number, value is left alone otherwise
+bool parse_option(const char* text, float& value) {
+    char* end;
+    float parsed = std::strtof(text, &end);
+    if (end == text || *end != '\0' || !(parsed > 0.0f) || std::isinf(parsed))
+        return false;
 
-        input_button_shader.use();
-        glBindVertexArray(input_button_vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, input_button_texture);
-        input_button_shader.setInt("button_tex", 0);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glBindVertexArray(0);
+    value = parsed;
+    return true;
+}
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-    }
+//zero is allowed, every scene is then evicted right away
+bool parse_option(const char* text, size_t& value) {
+    char* end;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (!std::isdigit(static_cast<unsigned char>(text[0])) || *end != '\0' || errno == ERANGE || parsed > SIZE_MAX / (1024 * 1024))
+        return false;
 
-    glfwTerminate();
-    return 0;
+    value = static_cast<size_t>(parsed);
+    return true;
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
     window_width = width;
     window_height = height;
-    for (int i = 0; i < layers; ++i) {
-        glBindTexture(GL_TEXTURE_2D, color_attachments[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, window_width, window_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    }
 
-    for (int i = 0; i < 2; ++i) {
-        glBindTexture(GL_TEXTURE_2D, peel_depths[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, window_width, window_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    }
+    viewer_event event(window_resize, glfwGetTime());
+    event.width = width;
+    event.height = height;
+    events.post(event);
+}
+
+//the window was uncovered or needs repainting, the cached frame is still valid unless something changed
+void window_refresh_callback(GLFWwindow* window) {
+    post_event(window_refresh);
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
-        if (action == GLFW_PRESS && !swap_model) {
+        if (action == GLFW_PRESS) {
             double click_x, click_y;
             glfwGetCursorPos(window, &click_x, &click_y);
             click_x = (click_x / window_width) * 2.0f - 1.0f;
@@ -276,16 +539,22 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
                 input_button_pressed = true;
                 GetOpenFileNameA(&f);
                 std::string temp = f.lpstrFile;
-                if (temp.size() > 0)
-                    swap_model = true;
+                if (temp.size() > 0) {
+                    viewer_event event(load_model, glfwGetTime());
+                    event.path = temp;
+                    events.post(event);
+                }
                 action = GLFW_RELEASE;
             }
             else if (!input_button_pressed) {
                 left_button_pressed = true;
                 glfwGetCursorPos(window, &last_x, &last_y);
+                post_event(drag_begin);
             }
         }
         else if (action == GLFW_RELEASE) {
+            if (left_button_pressed)
+                post_event(drag_end);
             left_button_pressed = false;
             input_button_pressed = false;
         }
@@ -294,9 +563,23 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    orbit_cam.radius -= (float)yoffset;
-    if (orbit_cam.radius < 1.0f)
-        orbit_cam.radius = 1.0f;
+    viewer_event event(camera_zoom, glfwGetTime());
+    event.dy = (float)yoffset;
+    events.post(event);
+}
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (action != GLFW_PRESS)
+        return;
+
+    if (key == GLFW_KEY_C)
+        post_event(toggle_compact_vertices);
+
+    if (key == GLFW_KEY_T)
+        post_event(cycle_transparency_mode);
+
+    if (key == GLFW_KEY_R)
+        post_event(toggle_temporal_peeling);
 }
 
 void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -304,11 +587,11 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
         return;
     }
 
-    yaw += (xpos - last_x) * 0.05;
-    pitch += (ypos - last_y) * 0.05;
-
-    yaw = std::fmod(yaw, 360.0f);
-    pitch = std::fmod(pitch, 360.0f);
+    //every cursor sample is forwarded as it arrives, however long the current frame takes
+    viewer_event event(camera_rotate, glfwGetTime());
+    event.dx = (float)((xpos - last_x) * 0.05);
+    event.dy = (float)((ypos - last_y) * 0.05);
+    events.post(event);
 
     last_x = xpos;
     last_y = ypos;
@@ -320,6 +603,7 @@ GLFWwindow* glfwSetup() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
 
     GLFWwindow* window = glfwCreateWindow(window_width, window_height, "Hamood_Viewer", NULL, NULL);
     if (window == NULL) {
@@ -337,6 +621,8 @@ GLFWwindow* glfwSetup() {
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
     glViewport(0, 0, window_width, window_height);
     glEnable(GL_DEPTH_TEST);
@@ -0,0 +1,279 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+// post transform cache, overdraw and vertex fetch ordering for indexed triangle lists.
+// cache order is tipsify (Sander, Nehab, Barczak 2007), overdraw order sorts the resulting
+// clusters so the ones facing away from the mesh center are drawn first
+
+const int vertex_cache_size = 16;
+
+class vertex_cache_stats {
+public:
+    float acmr; //transformed vertices per triangle
+    float atvr; //transformed vertices per referenced vertex, 1 is optimal
+
+    vertex_cache_stats() : acmr(0.0f), atvr(0.0f) {}
+};
+
+//fifo cache simulation, misses receives per triangle miss counts when given
+vertex_cache_stats analyze_vertex_cache(const unsigned int* indices, size_t index_count, size_t vertex_count, std::vector<unsigned int>* misses = nullptr) {
+    vertex_cache_stats result;
+    if (index_count == 0)
+        return result;
+
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    std::vector<bool> referenced(vertex_count, false);
+    unsigned int time = vertex_cache_size + 1;
+    size_t transformed = 0, unique = 0;
+
+    if (misses)
+        misses->assign(index_count / 3, 0);
+
+    for (auto i = 0u; i < index_count; ++i) {
+        unsigned int v = indices[i];
+
+        if (time - cache_time[v] > vertex_cache_size) {
+            cache_time[v] = time++;
+            ++transformed;
+            if (misses)
+                ++(*misses)[i / 3];
+        }
+
+        if (!referenced[v]) {
+            referenced[v] = true;
+            ++unique;
+        }
+    }
+
+    result.acmr = static_cast<float>(transformed) / (index_count / 3);
+    result.atvr = static_cast<float>(transformed) / unique;
+    return result;
+}
+
+//reorders triangles for the post transform cache
+void optimize_vertex_cache(unsigned int* indices, size_t index_count, size_t vertex_count) {
+    size_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    std::vector<unsigned int> offsets(vertex_count + 1, 0), adjacency(index_count);
+    std::vector<int> live(vertex_count, 0);
+
+    for (auto i = 0u; i < index_count; ++i) {
+        ++offsets[indices[i] + 1];
+        ++live[indices[i]];
+    }
+    for (auto v = 0u; v < vertex_count; ++v)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (auto i = 0u; i < index_count; ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<unsigned int> dead_end, candidates, output;
+    output.reserve(index_count);
+
+    unsigned int time = vertex_cache_size + 1;
+    size_t cursor = 0;
+    long long fanning = indices[0];
+
+    while (fanning >= 0) {
+        candidates.clear();
+
+        for (auto k = offsets[fanning]; k < offsets[fanning + 1]; ++k) {
+            unsigned int t = adjacency[k];
+            if (emitted[t])
+                continue;
+
+            for (auto e = 0; e < 3; ++e) {
+                unsigned int v = indices[t * 3 + e];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+
+                if (time - cache_time[v] > vertex_cache_size)
+                    cache_time[v] = time++;
+            }
+
+            emitted[t] = true;
+        }
+
+        //best candidate is the one that stays in cache longest while still having triangles left
+        long long best = -1;
+        int best_priority = -1;
+
+        for (auto v : candidates) {
+            if (live[v] <= 0)
+                continue;
+
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= vertex_cache_size)
+                priority = time - cache_time[v];
+
+            if (priority > best_priority) {
+                best = v;
+                best_priority = priority;
+            }
+        }
+
+        if (best == -1) {
+            while (!dead_end.empty() && best == -1) {
+                unsigned int v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v] > 0)
+                    best = v;
+            }
+
+            while (best == -1 && cursor < vertex_count) {
+                if (live[cursor] > 0)
+                    best = cursor;
+                ++cursor;
+            }
+        }
+
+        fanning = best;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+//fifo cache step for one triangle, returns how many of its vertices had to be transformed
+unsigned int update_vertex_cache(const unsigned int* triangle, std::vector<unsigned int>& cache_time, unsigned int& time) {
+    unsigned int misses = 0;
+
+    for (auto e = 0; e < 3; ++e) {
+        if (time - cache_time[triangle[e]] > vertex_cache_size) {
+            cache_time[triangle[e]] = time++;
+            ++misses;
+        }
+    }
+
+    return misses;
+}
+
+//splits the cache ordered triangles into clusters and draws outward facing clusters first.
+//a triangle missing all three vertices starts a new patch, patches are split further wherever a cluster
+//started from a cold cache stays within threshold times the patch acmr
+void optimize_overdraw(unsigned int* indices, size_t index_count, const std::vector<glm::vec3>& positions, float threshold) {
+    size_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    std::vector<unsigned int> cache_time(positions.size(), 0);
+    std::vector<unsigned int> patches;
+    unsigned int time = vertex_cache_size + 1;
+
+    for (auto t = 0u; t < triangle_count; ++t) {
+        if (update_vertex_cache(indices + t * 3, cache_time, time) == 3 || t == 0)
+            patches.push_back(t);
+    }
+
+    std::vector<unsigned int> clusters;
+    for (auto p = 0u; p < patches.size(); ++p) {
+        unsigned int start = patches[p];
+        unsigned int end = p + 1 < patches.size() ? patches[p + 1] : static_cast<unsigned int>(triangle_count);
+
+        time += vertex_cache_size + 1;
+        unsigned int patch_misses = 0;
+        for (auto t = start; t < end; ++t)
+            patch_misses += update_vertex_cache(indices + t * 3, cache_time, time);
+        float cluster_threshold = threshold * patch_misses / (end - start);
+
+        clusters.push_back(start);
+        time += vertex_cache_size + 1;
+        unsigned int running_misses = 0, running_triangles = 0;
+
+        for (auto t = start; t < end; ++t) {
+            running_misses += update_vertex_cache(indices + t * 3, cache_time, time);
+            ++running_triangles;
+
+            if (static_cast<float>(running_misses) / running_triangles <= cluster_threshold) {
+                clusters.push_back(t + 1);
+                time += vertex_cache_size + 1;
+                running_misses = 0;
+                running_triangles = 0;
+            }
+        }
+
+        //the tail after the last split is rarely good on its own, fold it into the previous cluster
+        if (clusters.back() != start)
+            clusters.pop_back();
+    }
+
+    glm::vec3 mesh_center(0.0f);
+    float mesh_area = 0.0f;
+    std::vector<std::pair<float, unsigned int>> order(clusters.size());
+    std::vector<glm::vec3> centers(clusters.size(), glm::vec3(0.0f)), normals(clusters.size(), glm::vec3(0.0f));
+    std::vector<float> areas(clusters.size(), 0.0f);
+
+    for (auto c = 0u; c < clusters.size(); ++c) {
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<unsigned int>(triangle_count);
+
+        for (auto t = clusters[c]; t < end; ++t) {
+            const glm::vec3& p0 = positions[indices[t * 3]];
+            const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+            const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 n(glm::cross(p1 - p0, p2 - p0));
+            float area = glm::length(n);
+
+            centers[c] += (p0 + p1 + p2) * (area / 3.0f);
+            normals[c] += n;
+            areas[c] += area;
+        }
+
+        mesh_center += centers[c];
+        mesh_area += areas[c];
+    }
+
+    if (mesh_area > 0.0f)
+        mesh_center /= mesh_area;
+
+    for (auto c = 0u; c < clusters.size(); ++c) {
+        float n_len = glm::length(normals[c]);
+        glm::vec3 center = areas[c] > 0.0f ? centers[c] / areas[c] : mesh_center;
+        float key = n_len > 0.0f ? glm::dot(center - mesh_center, normals[c] / n_len) : 0.0f;
+        order[c] = { -key, c };
+    }
+
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<float, unsigned int>& l, const std::pair<float, unsigned int>& r) {
+        return l.first < r.first;
+    });
+
+    std::vector<unsigned int> output;
+    output.reserve(index_count);
+    for (auto& entry : order) {
+        unsigned int c = entry.second;
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<unsigned int>(triangle_count);
+        output.insert(output.end(), indices + clusters[c] * 3, indices + end * 3);
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+//vertex order by first use so fetches walk the vertex buffer forward, returns old index -> new index
+std::vector<unsigned int> optimize_vertex_fetch_remap(const std::vector<unsigned int>& indices, size_t vertex_count) {
+    std::vector<unsigned int> remap(vertex_count, ~0u);
+    unsigned int next = 0;
+
+    for (auto index : indices) {
+        if (remap[index] == ~0u)
+            remap[index] = next++;
+    }
+
+    //vertices no triangle uses go to the end
+    for (auto& r : remap) {
+        if (r == ~0u)
+            r = next++;
+    }
+
+    return remap;
+}
+
+#endif
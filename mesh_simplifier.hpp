@@ -0,0 +1,315 @@
+#ifndef MESH_SIMPLIFIER_HPP
+#define MESH_SIMPLIFIER_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <glm/glm.hpp>
+
+// quadric error metric simplification by half edge collapse,
+// vertices only ever move onto an existing neighbour so uvs and normals are never interpolated
+
+class quadric {
+public:
+    double a00, a11, a22, a01, a12, a02, b0, b1, b2, c, w;
+
+    quadric() : a00(0), a11(0), a22(0), a01(0), a12(0), a02(0), b0(0), b1(0), b2(0), c(0), w(0) {}
+
+    quadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+        glm::dvec3 e0(glm::dvec3(p1) - glm::dvec3(p0));
+        glm::dvec3 e1(glm::dvec3(p2) - glm::dvec3(p0));
+        glm::dvec3 n(glm::cross(e0, e1));
+        double len = glm::length(n);
+        double area = 0.5 * len;
+
+        if (len > 0.0)
+            n /= len;
+
+        double d = -glm::dot(n, glm::dvec3(p0));
+
+        a00 = n.x * n.x * area; a11 = n.y * n.y * area; a22 = n.z * n.z * area;
+        a01 = n.x * n.y * area; a12 = n.y * n.z * area; a02 = n.x * n.z * area;
+        b0 = n.x * d * area; b1 = n.y * d * area; b2 = n.z * d * area;
+        c = d * d * area;
+        w = area;
+    }
+
+    quadric& operator+=(const quadric& rhs) {
+        a00 += rhs.a00; a11 += rhs.a11; a22 += rhs.a22;
+        a01 += rhs.a01; a12 += rhs.a12; a02 += rhs.a02;
+        b0 += rhs.b0; b1 += rhs.b1; b2 += rhs.b2;
+        c += rhs.c; w += rhs.w;
+        return *this;
+    }
+
+    //squared distance to the accumulated planes, normalized by area so it is in model units squared
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double r = a00 * x * x + a11 * y * y + a22 * z * z
+            + 2.0 * (a01 * x * y + a12 * y * z + a02 * x * z)
+            + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+
+        return w > 0.0 ? std::fabs(r) / w : 0.0;
+    }
+};
+
+struct position_hash {
+    size_t operator()(const glm::vec3& p) const {
+        uint32_t h[3];
+        std::memcpy(h, &p, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+    }
+};
+
+class mesh_simplifier {
+public:
+    mesh_simplifier(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals);
+
+    //returns the simplified index buffer, error is the largest collapse distance in model units
+    std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices, size_t target_index_count, float& error);
+
+private:
+    struct collapse {
+        float cost;
+        unsigned int from, to;
+    };
+
+    const std::vector<glm::vec3>& positions;
+    const std::vector<glm::vec3>& normals;
+    std::vector<unsigned int> position_remap;
+    std::vector<bool> wedge;
+
+    std::vector<unsigned int> adjacency_offsets, adjacency;
+    std::vector<bool> locked;
+    std::vector<quadric> quadrics;
+
+    void build_adjacency(const std::vector<unsigned int>& indices);
+    void classify_vertices(const std::vector<unsigned int>& indices);
+    bool collapse_valid(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& collapse_remap, unsigned int from, unsigned int to) const;
+};
+
+mesh_simplifier::mesh_simplifier(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals) :
+    positions(positions), normals(normals) {
+    //vertices sharing a position are wedges of the same corner (uv seam or hard normal edge)
+    std::unordered_map<glm::vec3, unsigned int, position_hash> first_with_position;
+    first_with_position.reserve(positions.size());
+
+    position_remap.resize(positions.size());
+    wedge.assign(positions.size(), false);
+
+    for (auto i = 0u; i < positions.size(); ++i) {
+        auto it = first_with_position.emplace(positions[i], i);
+        position_remap[i] = it.first->second;
+
+        if (!it.second) {
+            wedge[i] = true;
+            wedge[it.first->second] = true;
+        }
+    }
+}
+
+void mesh_simplifier::build_adjacency(const std::vector<unsigned int>& indices) {
+    adjacency_offsets.assign(positions.size() + 1, 0);
+
+    for (auto index : indices)
+        ++adjacency_offsets[index + 1];
+
+    for (auto i = 0u; i < positions.size(); ++i)
+        adjacency_offsets[i + 1] += adjacency_offsets[i];
+
+    adjacency.resize(indices.size());
+    std::vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+
+    for (auto i = 0u; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+}
+
+void mesh_simplifier::classify_vertices(const std::vector<unsigned int>& indices) {
+    //an edge is open when its reverse is missing, this catches mesh borders, material borders and chunk cuts
+    std::unordered_map<uint64_t, int> half_edges;
+    half_edges.reserve(indices.size());
+
+    for (auto i = 0u; i < indices.size(); i += 3) {
+        for (auto e = 0; e < 3; ++e) {
+            uint64_t a = position_remap[indices[i + e]];
+            uint64_t b = position_remap[indices[i + (e + 1) % 3]];
+            ++half_edges[(a << 32) | b];
+        }
+    }
+
+    locked.assign(positions.size(), false);
+
+    for (auto i = 0u; i < indices.size(); i += 3) {
+        for (auto e = 0; e < 3; ++e) {
+            uint64_t a = position_remap[indices[i + e]];
+            uint64_t b = position_remap[indices[i + (e + 1) % 3]];
+            auto reverse = half_edges.find((b << 32) | a);
+
+            if (reverse == half_edges.end() || reverse->second != 1 || half_edges[(a << 32) | b] != 1) {
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+    }
+
+    for (auto i = 0u; i < positions.size(); ++i) {
+        if (wedge[i] || locked[position_remap[i]])
+            locked[i] = true;
+    }
+
+    quadrics.assign(positions.size(), quadric());
+
+    for (auto i = 0u; i < indices.size(); i += 3) {
+        quadric q(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+
+        for (auto e = 0; e < 3; ++e)
+            quadrics[position_remap[indices[i + e]]] += q;
+    }
+}
+
+bool mesh_simplifier::collapse_valid(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& collapse_remap, unsigned int from, unsigned int to) const {
+    //collapsing moves the vertex, so the normals of its wedge have to roughly agree
+    if (glm::dot(normals[from], normals[to]) < 0.5f)
+        return false;
+
+    const glm::vec3& target = positions[to];
+
+    for (auto k = adjacency_offsets[from]; k < adjacency_offsets[from + 1]; ++k) {
+        unsigned int tri = adjacency[k] * 3;
+        unsigned int v[3] = { collapse_remap[indices[tri]], collapse_remap[indices[tri + 1]], collapse_remap[indices[tri + 2]] };
+
+        if (v[0] == to || v[1] == to || v[2] == to)
+            continue;
+
+        //another wedge of the target position would leave a zero area triangle behind
+        if (position_remap[v[0]] == position_remap[to] || position_remap[v[1]] == position_remap[to] || position_remap[v[2]] == position_remap[to])
+            return false;
+
+        glm::vec3 p[3] = { positions[v[0]], positions[v[1]], positions[v[2]] };
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+        for (auto e = 0; e < 3; ++e) {
+            if (v[e] == from)
+                p[e] = target;
+        }
+
+        glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+        float before_len = glm::length(before), after_len = glm::length(after);
+        if (before_len == 0.0f || after_len == 0.0f)
+            continue;
+
+        if (glm::dot(before, after) < 0.25f * before_len * after_len)
+            return false;
+    }
+
+    return true;
+}
+
+std::vector<unsigned int> mesh_simplifier::simplify(const std::vector<unsigned int>& source, size_t target_index_count, float& error) {
+    std::vector<unsigned int> indices(source);
+    double max_cost = 0.0;
+
+    classify_vertices(indices);
+
+    std::vector<unsigned int> collapse_remap(positions.size());
+    std::vector<bool> collapse_locked(positions.size());
+    std::vector<collapse> candidates;
+
+    while (indices.size() > target_index_count) {
+        build_adjacency(indices);
+        candidates.clear();
+
+        for (auto i = 0u; i < indices.size(); i += 3) {
+            for (auto e = 0; e < 3; ++e) {
+                unsigned int a = indices[i + e];
+                unsigned int b = indices[i + (e + 1) % 3];
+
+                //interior edges are visited from both triangles, only keep one of them
+                if (a > b)
+                    continue;
+
+                quadric q = quadrics[position_remap[a]];
+                q += quadrics[position_remap[b]];
+
+                double cost_ab = locked[a] ? DBL_MAX : q.error(positions[b]);
+                double cost_ba = locked[b] ? DBL_MAX : q.error(positions[a]);
+
+                if (cost_ab == DBL_MAX && cost_ba == DBL_MAX)
+                    continue;
+
+                if (cost_ab <= cost_ba)
+                    candidates.push_back({ static_cast<float>(cost_ab), a, b });
+                else
+                    candidates.push_back({ static_cast<float>(cost_ba), b, a });
+            }
+        }
+
+        if (candidates.empty())
+            break;
+
+        std::sort(candidates.begin(), candidates.end(), [](const collapse& l, const collapse& r) {
+            return l.cost < r.cost;
+        });
+
+        for (auto i = 0u; i < collapse_remap.size(); ++i)
+            collapse_remap[i] = i;
+        std::fill(collapse_locked.begin(), collapse_locked.end(), false);
+
+        size_t triangles_to_remove = (indices.size() - target_index_count) / 3;
+        size_t triangles_removed = 0;
+        size_t collapses = 0;
+
+        for (auto& c : candidates) {
+            if (triangles_removed >= triangles_to_remove)
+                break;
+
+            if (collapse_locked[c.from] || collapse_locked[c.to])
+                continue;
+
+            if (!collapse_valid(indices, collapse_remap, c.from, c.to))
+                continue;
+
+            for (auto k = adjacency_offsets[c.from]; k < adjacency_offsets[c.from + 1]; ++k) {
+                unsigned int tri = adjacency[k] * 3;
+                if (collapse_remap[indices[tri]] == c.to || collapse_remap[indices[tri + 1]] == c.to || collapse_remap[indices[tri + 2]] == c.to)
+                    ++triangles_removed;
+            }
+
+            //neighbours stay locked for the rest of the pass so the flip test above never works on stale triangles
+            for (auto k = adjacency_offsets[c.from]; k < adjacency_offsets[c.from + 1]; ++k) {
+                unsigned int tri = adjacency[k] * 3;
+                for (auto e = 0; e < 3; ++e)
+                    collapse_locked[indices[tri + e]] = true;
+            }
+
+            collapse_remap[c.from] = c.to;
+            collapse_locked[c.to] = true;
+            quadrics[position_remap[c.to]] += quadrics[position_remap[c.from]];
+            max_cost = std::max(max_cost, static_cast<double>(c.cost));
+            ++collapses;
+        }
+
+        if (collapses == 0)
+            break;
+
+        size_t write = 0;
+        for (auto i = 0u; i < indices.size(); i += 3) {
+            unsigned int a = collapse_remap[indices[i]], b = collapse_remap[indices[i + 1]], c = collapse_remap[indices[i + 2]];
+
+            if (a == b || b == c || a == c)
+                continue;
+
+            indices[write++] = a; indices[write++] = b; indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+
+    error = static_cast<float>(std::sqrt(max_cost));
+    return indices;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef QUALITY_GOVERNOR_HPP
+#define QUALITY_GOVERNOR_HPP
+
+#include <string>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+// holds a frame time budget while the camera is dragged by trading peel passes and render resolution.
+// the slower of the measured gpu and cpu time is compared against budget_ms once the settings it was
+// measured with are the current ones: over budget steps quality down, well under it steps back up.
+// down, passes go first until min_passes, then the render scale, then the last passes.
+// once the drag ends quality comes back one step per frame, in the reverse order
+
+const float governor_scales[] = { 1.0f, 0.85f, 0.7f, 0.6f, 0.5f };
+const int governor_scale_count = sizeof(governor_scales) / sizeof(governor_scales[0]);
+
+class quality_governor {
+public:
+    float budget_ms;
+    float headroom; //fraction of the budget a frame has to stay under before quality goes up again
+    int min_passes; //passes kept while the render scale still has room to drop
+    bool interacting;
+    double gpu_ms, cpu_ms;
+
+    quality_governor(float budget_ms) : budget_ms(budget_ms), headroom(0.7f), min_passes(2), interacting(false), gpu_ms(0.0), cpu_ms(0.0),
+        scale_level(0), pass_limit(0), frame(0), changed_frame(0), measured_frame(0), queries{ 0, 0, 0 } {
+    }
+
+    void begin_frame();
+    void end_frame(renderer& r);
+    bool restoring() const { return !interacting && degraded(); }
+    bool degraded() const { return scale_level > 0 || pass_limit > 0; }
+    std::string summary() const;
+
+    quality_governor(const quality_governor&) = delete;
+    quality_governor& operator=(const quality_governor&) = delete;
+
+    ~quality_governor() {
+        if (queries[0] != 0)
+            glDeleteQueries(query_count, queries);
+    }
+
+private:
+    static const int query_count = 3;
+    int scale_level;
+    int pass_limit; //0 while passes are not limited
+    unsigned long long frame, changed_frame, measured_frame;
+    unsigned int queries[query_count];
+    std::chrono::steady_clock::time_point cpu_start;
+
+    void read_gpu_times();
+    bool step_down(const renderer& r);
+    bool step_up(const renderer& r);
+    void apply(renderer& r);
+};
+
+//gpu time comes from a ring of timer queries read a few frames late, the cpu time is what the frame took to submit
+void quality_governor::begin_frame() {
+    if (queries[0] == 0)
+        glGenQueries(query_count, queries);
+
+    ++frame;
+    cpu_start = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame % query_count]);
+}
+
+//results come back in order, so reading stops at the first frame that is not done yet
+void quality_governor::read_gpu_times() {
+    unsigned long long oldest = frame >= query_count ? frame - query_count + 1 : 1;
+
+    for (auto query_frame = std::max(measured_frame + 1, oldest); query_frame <= frame; ++query_frame) {
+        unsigned int available = 0;
+        glGetQueryObjectuiv(queries[query_frame % query_count], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[query_frame % query_count], GL_QUERY_RESULT, &elapsed);
+        gpu_ms = elapsed / 1000000.0;
+        measured_frame = query_frame;
+    }
+}
+
+void quality_governor::end_frame(renderer& r) {
+    glEndQuery(GL_TIME_ELAPSED);
+    cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpu_start).count();
+    read_gpu_times();
+
+    bool changed = false;
+    if (!interacting) {
+        changed = step_up(r);
+    }
+    else if (measured_frame > changed_frame) {
+        //only timings of frames rendered with the current settings count
+        double frame_ms = std::max(gpu_ms, cpu_ms);
+        if (frame_ms > budget_ms)
+            changed = step_down(r);
+        else if (frame_ms < budget_ms * headroom)
+            changed = step_up(r);
+    }
+
+    if (changed) {
+        changed_frame = frame;
+        apply(r);
+    }
+}
+
+bool quality_governor::step_down(const renderer& r) {
+    int passes = pass_limit > 0 ? pass_limit : r.peel_passes;
+
+    if (passes > min_passes)
+        pass_limit = passes - 1;
+    else if (scale_level + 1 < governor_scale_count)
+        ++scale_level;
+    else if (passes > 1)
+        pass_limit = passes - 1;
+    else
+        return false;
+
+    return true;
+}
+
+bool quality_governor::step_up(const renderer& r) {
+    if (pass_limit > 0 && pass_limit < min_passes)
+        ++pass_limit;
+    else if (scale_level > 0)
+        --scale_level;
+    else if (pass_limit > 0)
+        pass_limit = pass_limit + 1 >= r.max_passes() ? 0 : pass_limit + 1;
+    else
+        return false;
+
+    return true;
+}
+
+void quality_governor::apply(renderer& r) {
+    r.pass_limit = pass_limit > 0 ? pass_limit : r.layers;
+    r.set_render_scale(governor_scales[scale_level]);
+}
+
+std::string quality_governor::summary() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "gov " << static_cast<int>(governor_scales[scale_level] * 100.0f) << "%";
+    if (pass_limit > 0)
+        out << " <=" << pass_limit << " passes";
+    out << " gpu " << gpu_ms << " cpu " << cpu_ms << "/" << budget_ms << " ms";
+    return out.str();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef RENDER_TARGET_HPP
+#define RENDER_TARGET_HPP
+
+#include <vector>
+
+// offscreen srgb color and depth target, the renderer composites into it for the benchmarks
+// and for the frame the viewer keeps to present again without rendering
+
+class render_target {
+public:
+    unsigned int fbo, color, depth;
+    int width, height;
+
+    render_target(int width, int height) : width(0), height(0) {
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &color);
+        glGenRenderbuffers(1, &depth);
+        resize(width, height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void resize(int new_width, int new_height) {
+        if (new_width == width && new_height == height)
+            return;
+
+        width = new_width;
+        height = new_height;
+        glBindTexture(GL_TEXTURE_2D, color);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    }
+
+    //copies the color into target_fbo at the same size, srgb writes on so the blit re-encodes what it decodes
+    void present(unsigned int target_fbo) const {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+
+    std::vector<unsigned char> read_pixels() const {
+        std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 4);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return pixels;
+    }
+
+    render_target(const render_target&) = delete;
+    render_target& operator=(const render_target&) = delete;
+
+    ~render_target() {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &color);
+        glDeleteRenderbuffers(1, &depth);
+    }
+};
+
+#endif
@@ -0,0 +1,1058 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "gl_image_load_store.hpp"
+#include "triangle_sort.hpp"
+#include "vertex_feedback.hpp"
+
+// scene rendering with order independent transparency. opaque meshes are drawn once into a base layer,
+// translucent meshes are peeled on top of it and the layers are composited over the bound framebuffer.
+// layers live in one srgb texture array so color is blended in linear space and encoded on write,
+// the composite is a single pass over the array that writes srgb into the target.
+// clears, passes and the composite are scissored to the screen rectangle of the scene's bounding sphere.
+// layers can be rendered at render_scale of the output size, the composite then upscales them bilinearly
+//
+// front_to_back_peeling extracts one layer per geometry pass and blends it under the layers before it,
+// pixels the layers so far already cover up to saturation_alpha are stenciled out of later passes.
+// with temporal_peeling a moving view peels only the front or the back half of the layers per frame and
+// reprojects the other half from the frame that peeled it last. dual_depth_peeling (Bavoil, Myers 2008)
+// extracts the nearest and the farthest remaining layer per pass with max blending into an rg32f target.
+// weighted_blended (McGuire, Bavoil 2013) is a single approximate pass into an accumulation and a weight target.
+// k_buffer needs gl 4.2: one pass stores up to kbuffer_size fragments per pixel with image load/store,
+// the resolve sorts and blends them. fragments past kbuffer_size are dropped and their pixels counted.
+// cpu_sorted radix sorts the translucent triangles on the cpu and blends them back to front in one draw
+
+enum transparency_mode {
+    front_to_back_peeling,
+    dual_depth_peeling,
+    weighted_blended,
+    k_buffer,
+    cpu_sorted,
+    transparency_mode_count
+};
+
+const char* transparency_mode_names[] = { "peel", "dual peel", "weighted", "k-buffer", "cpu sort" };
+
+const int max_kbuffer_size = 16;
+const glm::vec3 light_location(0.0f, 25.0f, 0.0f);
+
+//ARB_pipeline_statistics_query, counts fragment shader invocations where the driver has it
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+
+bool has_gl_extension(const std::string& name) {
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; ++i) {
+        if (name == reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)))
+            return true;
+    }
+    return false;
+}
+
+class renderer {
+public:
+    int width, height; //internal size the layers are rendered at
+    int output_width, output_height; //size of the target the composite writes
+    float render_scale;
+    int layers;
+    int pass_limit; //upper bound on peel passes on top of the adaptive budget
+    transparency_mode mode;
+    unsigned int peel_fragment_threshold;
+    int peel_passes;
+    size_t target_bytes;
+    int kbuffer_size;
+    unsigned int kbuffer_overflow_pixels;
+    bool kbuffer_supported;
+    triangle_sorter sorter;
+    glm::ivec4 scissor_rect; //x, y, width, height
+    size_t cleared_pixels;
+    float saturation_alpha;
+    std::vector<unsigned int> layer_fragments; //shaded fragments per peel pass, a frame late
+    bool reuse_transforms;
+    vertex_feedback feedback;
+    bool temporal_peeling;
+    int reused_passes; //passes reprojected from an earlier frame instead of peeled this frame
+    float temporal_max_degrees; //larger view rotations between frames peel every layer
+    float temporal_depth_bias;
+
+    renderer(const std::string& shader_dir, int width, int height, int layers);
+    void resize(int new_width, int new_height);
+    void set_render_scale(float scale);
+    void set_mode(transparency_mode new_mode);
+    void set_temporal_peeling(bool enabled);
+    bool mode_supported(transparency_mode m) const;
+    void render(scene& s, const glm::mat4& model_matrix, const glm::mat4& view, const glm::mat4& projection, unsigned int target_fbo);
+    void composite(unsigned int target_fbo, int layer_count);
+    bool peel_results_pending() const { return queried_passes > 0; }
+    bool poll_peel_budget();
+    int max_passes() const;
+
+    renderer(const renderer&) = delete;
+    renderer& operator=(const renderer&) = delete;
+
+private:
+    Shader main_shader, screen_shader, dual_blend_shader, weighted_resolve_shader, saturation_shader;
+    Shader capture_shader, transformed_shader, reproject_shader;
+    unsigned int quad_vao, quad_vbo;
+    unsigned int peel_fbo, dual_fbo, weighted_fbo;
+    unsigned int layer_array, peel_layer;
+    unsigned int peel_depths[2], opaque_depth;
+    unsigned int dual_depths[2], dual_fronts[2], dual_back_temps[2];
+    unsigned int weighted_accum, weighted_weight;
+    std::unique_ptr<Shader> kbuffer_resolve_shader;
+    unsigned int kbuffer_fbo, kbuffer_count, kbuffer_fragments;
+    unsigned int kbuffer_counters[2];
+    int kbuffer_frame;
+    std::vector<unsigned int> peel_queries, shade_queries;
+    bool shade_queries_supported, shade_queried;
+    int peel_budget, queried_passes;
+    unsigned int history_fbo, history_front, history_tail;
+    unsigned int history_front_depth, history_split_depth, history_tail_depth, start_depth;
+    glm::mat4 front_clip, tail_clip, last_view;
+    glm::ivec4 front_rect, tail_rect;
+    bool history_valid, back_frame;
+    int history_passes, temporal_frames;
+
+    void allocate_texture(unsigned int texture, int internal_format, unsigned int format, unsigned int type, int texel_bytes, bool used);
+    void allocate_targets();
+    void update_peel_budget();
+    void attach_layer(int layer);
+    void count_clear(int targets);
+    int peel_front_to_back(scene& s, int passes, const glm::mat4& model_matrix, const glm::mat4& view, const glm::mat4& projection);
+    void peel_layers(scene& s, Shader& peel_shader, int first, int count, unsigned int start, int accum_layer, bool query, unsigned int first_depth_history);
+    bool temporal_view(const glm::mat4& view, int passes) const;
+    void save_peel_depth(unsigned int history_depth);
+    void save_layer(int layer, unsigned int history_color);
+    void reproject_history(bool back, const glm::mat4& clip_matrix);
+    void peel_dual(scene& s, int passes);
+    void blend_weighted(scene& s);
+    void blend_kbuffer(scene& s);
+    void blend_sorted(scene& s, const glm::mat4& view_model);
+    void read_kbuffer_overflow();
+};
+
+renderer::renderer(const std::string& shader_dir, int width, int height, int layers) :
+    width(width), height(height), output_width(width), output_height(height), render_scale(1.0f), layers(layers), pass_limit(layers), mode(front_to_back_peeling), peel_fragment_threshold(0), peel_passes(0), target_bytes(0),
+    kbuffer_size(8), kbuffer_overflow_pixels(0), kbuffer_supported(false), scissor_rect(0, 0, width, height), cleared_pixels(0),
+    saturation_alpha(0.996f), reuse_transforms(true), temporal_peeling(false), reused_passes(0), temporal_max_degrees(5.0f), temporal_depth_bias(1e-4f),
+    main_shader((shader_dir + "/shader.vs").c_str(), (shader_dir + "/shader.fs").c_str()),
+    screen_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/screen.fs").c_str()),
+    dual_blend_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/dual_blend.fs").c_str()),
+    weighted_resolve_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/weighted_resolve.fs").c_str()),
+    saturation_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/saturation_mark.fs").c_str()),
+    capture_shader((shader_dir + "/transform_capture.vs").c_str(), std::vector<std::string>{ "clip_position", "view_position", "view_normal" }),
+    transformed_shader((shader_dir + "/transformed.vs").c_str(), (shader_dir + "/shader.fs").c_str()),
+    reproject_shader((shader_dir + "/screen.vs").c_str(), (shader_dir + "/temporal_reproject.fs").c_str()),
+    kbuffer_fbo(0), kbuffer_count(0), kbuffer_fragments(0), kbuffer_counters{ 0, 0 }, kbuffer_frame(0),
+    peel_queries(layers - 1), shade_queries(layers - 1), shade_queries_supported(false), shade_queried(false), peel_budget(layers - 1), queried_passes(0),
+    history_valid(false), back_frame(false), history_passes(0), temporal_frames(0) {
+
+    float quad_vertices[] = {
+        -1.0f,  1.0f,  0.0f, 1.0f,
+        -1.0f, -1.0f,  0.0f, 0.0f,
+         1.0f, -1.0f,  1.0f, 0.0f,
+
+        -1.0f,  1.0f,  0.0f, 1.0f,
+         1.0f, -1.0f,  1.0f, 0.0f,
+         1.0f,  1.0f,  1.0f, 1.0f
+    };
+
+    glGenVertexArrays(1, &quad_vao);
+    glGenBuffers(1, &quad_vbo);
+    glBindVertexArray(quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+    glBindVertexArray(0);
+
+    glGenFramebuffers(1, &peel_fbo);
+    glGenFramebuffers(1, &dual_fbo);
+    glGenFramebuffers(1, &weighted_fbo);
+    glGenTextures(1, &layer_array);
+    glGenTextures(1, &peel_layer);
+    glGenTextures(2, peel_depths);
+    glGenTextures(1, &opaque_depth);
+    glGenTextures(2, dual_depths);
+    glGenTextures(2, dual_fronts);
+    glGenTextures(2, dual_back_temps);
+    glGenTextures(1, &weighted_accum);
+    glGenTextures(1, &weighted_weight);
+    glGenFramebuffers(1, &history_fbo);
+    glGenTextures(1, &history_front);
+    glGenTextures(1, &history_tail);
+    glGenTextures(1, &history_front_depth);
+    glGenTextures(1, &history_split_depth);
+    glGenTextures(1, &history_tail_depth);
+    glGenTextures(1, &start_depth);
+    glGenQueries(layers - 1, peel_queries.data());
+
+    //without the extension the per layer counts fall back to the samples each peel wrote
+    shade_queries_supported = has_gl_extension("GL_ARB_pipeline_statistics_query");
+    if (shade_queries_supported)
+        glGenQueries(layers - 1, shade_queries.data());
+
+    //the k-buffer resolve is a 4.2 shader, it is only compiled where it can run
+    kbuffer_supported = load_image_load_store();
+    if (kbuffer_supported) {
+        kbuffer_resolve_shader = std::make_unique<Shader>((shader_dir + "/screen.vs").c_str(), (shader_dir + "/kbuffer_resolve.fs").c_str());
+        glGenFramebuffers(1, &kbuffer_fbo);
+        glGenTextures(1, &kbuffer_count);
+        glGenTextures(1, &kbuffer_fragments);
+
+        //two overflow counters, one written this frame while last frame's is read back
+        glGenBuffers(2, kbuffer_counters);
+        for (int i = 0; i < 2; ++i) {
+            unsigned int zero = 0;
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, kbuffer_counters[i]);
+            glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(unsigned int), &zero, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+    }
+
+    allocate_targets();
+
+    //dual peeling always draws into the same seven targets, the base layer doubles as the back blender
+    glBindFramebuffer(GL_FRAMEBUFFER, dual_fbo);
+    for (int i = 0; i < 2; ++i) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i * 3, GL_TEXTURE_2D, dual_depths[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 + i * 3, GL_TEXTURE_2D, dual_fronts[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2 + i * 3, GL_TEXTURE_2D, dual_back_temps[i], 0);
+    }
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT6, layer_array, 0, 0);
+
+    //weighted blending depth tests against the opaque depth in hardware, without writing it
+    glBindFramebuffer(GL_FRAMEBUFFER, weighted_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, weighted_accum, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weighted_weight, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, opaque_depth, 0);
+
+    //the count image doubles as the k-buffer framebuffer's only attachment so it can be cleared like a target
+    if (kbuffer_supported) {
+        glBindFramebuffer(GL_FRAMEBUFFER, kbuffer_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, kbuffer_count, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//targets the current mode does not use are kept at zero size
+void renderer::allocate_texture(unsigned int texture, int internal_format, unsigned int format, unsigned int type, int texel_bytes, bool used) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, used ? width : 0, used ? height : 0, 0, format, type, NULL);
+    if (used)
+        target_bytes += static_cast<size_t>(width) * height * texel_bytes;
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void renderer::allocate_targets() {
+    bool peel = mode == front_to_back_peeling, dual = mode == dual_depth_peeling, weighted = mode == weighted_blended;
+    target_bytes = 0;
+
+    //the base layer, plus the accumulation of everything in front of it when peeling front to back.
+    //peeling only keeps the layer being peeled and that accumulation, not every layer.
+    //temporal peeling accumulates the back half in layer 1 and the front half in layer 2
+    bool temporal = peel && temporal_peeling;
+    int array_layers = peel ? (temporal ? 3 : 2) : 1;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, layer_array);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, width, height, array_layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    //linear so the composite can upscale, at render_scale 1 it samples texel centers and matches nearest
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    target_bytes += static_cast<size_t>(width) * height * array_layers * 4;
+
+    allocate_texture(peel_layer, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, peel);
+
+    for (int i = 0; i < 2; ++i) {
+        allocate_texture(peel_depths[i], GL_DEPTH32F_STENCIL8, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 8, peel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+        allocate_texture(dual_depths[i], GL_RG32F, GL_RG, GL_FLOAT, 8, dual);
+        allocate_texture(dual_fronts[i], GL_RGBA16F, GL_RGBA, GL_FLOAT, 8, dual);
+        allocate_texture(dual_back_temps[i], GL_RGBA16F, GL_RGBA, GL_FLOAT, 8, dual);
+    }
+
+    //what the last frames peeled of each half and the depths to reproject it with
+    allocate_texture(history_front, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, temporal);
+    allocate_texture(history_tail, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, temporal);
+    for (unsigned int history_depth : { history_front_depth, history_split_depth, history_tail_depth }) {
+        allocate_texture(history_depth, GL_DEPTH32F_STENCIL8, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 8, temporal);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+    allocate_texture(start_depth, GL_R32F, GL_RED, GL_FLOAT, 4, temporal);
+    history_valid = false;
+
+    allocate_texture(weighted_accum, GL_RGBA16F, GL_RGBA, GL_FLOAT, 8, weighted);
+    allocate_texture(weighted_weight, GL_R16F, GL_RED, GL_FLOAT, 2, weighted);
+
+    if (kbuffer_supported) {
+        bool kbuffer = mode == k_buffer;
+        allocate_texture(kbuffer_count, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, 4, kbuffer);
+
+        //depth and packed color per fragment, kbuffer_size layers deep
+        glBindTexture(GL_TEXTURE_2D_ARRAY, kbuffer_fragments);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32UI, kbuffer ? width : 0, kbuffer ? height : 0, kbuffer ? kbuffer_size : 0, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+        if (kbuffer)
+            target_bytes += static_cast<size_t>(width) * height * kbuffer_size * 8;
+    }
+
+    allocate_texture(opaque_depth, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4, true);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+}
+
+//new_width and new_height are the output size, the targets are reallocated only when the internal size changes
+void renderer::resize(int new_width, int new_height) {
+    output_width = new_width;
+    output_height = new_height;
+
+    int internal_width = std::max(1, static_cast<int>(std::lround(new_width * render_scale)));
+    int internal_height = std::max(1, static_cast<int>(std::lround(new_height * render_scale)));
+    if (internal_width == width && internal_height == height)
+        return;
+
+    width = internal_width;
+    height = internal_height;
+    scissor_rect = glm::ivec4(0, 0, width, height);
+    allocate_targets();
+}
+
+void renderer::set_render_scale(float scale) {
+    render_scale = scale;
+    resize(output_width, output_height);
+}
+
+void renderer::set_mode(transparency_mode new_mode) {
+    if (new_mode != mode) {
+        mode = new_mode;
+        allocate_targets();
+    }
+
+    sorter.invalidate();
+    history_valid = false;
+    peel_budget = max_passes();
+    queried_passes = 0;
+    layer_fragments.clear();
+}
+
+void renderer::set_temporal_peeling(bool enabled) {
+    if (enabled == temporal_peeling)
+        return;
+
+    temporal_peeling = enabled;
+    allocate_targets();
+}
+
+bool renderer::mode_supported(transparency_mode m) const {
+    return m != k_buffer || kbuffer_supported;
+}
+
+//dual peeling takes two layers per pass, so it covers the same depth in half the passes
+int renderer::max_passes() const {
+    if (mode == weighted_blended || mode == k_buffer || mode == cpu_sorted)
+        return 1;
+    return mode == dual_depth_peeling ? layers / 2 : layers - 1;
+}
+
+//peels up to and including the first pass that wrote no more than peel_fragment_threshold fragments,
+//or one pass more when every pass still wrote some, so the count can grow with the depth complexity.
+//results are read a frame late and only once available so the pipeline never stalls
+void renderer::update_peel_budget() {
+    if (queried_passes == 0)
+        return;
+
+    unsigned int available = 0;
+    glGetQueryObjectuiv(peel_queries[queried_passes - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available && shade_queried)
+        glGetQueryObjectuiv(shade_queries[queried_passes - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    int produced = queried_passes;
+    layer_fragments.assign(queried_passes, 0);
+    for (int i = 0; i < queried_passes; ++i) {
+        unsigned int samples = 0;
+        glGetQueryObjectuiv(peel_queries[i], GL_QUERY_RESULT, &samples);
+        if (samples <= peel_fragment_threshold && produced == queried_passes)
+            produced = i;
+
+        layer_fragments[i] = samples;
+        if (shade_queried)
+            glGetQueryObjectuiv(shade_queries[i], GL_QUERY_RESULT, &layer_fragments[i]);
+    }
+
+    peel_budget = std::min(produced + 1, max_passes());
+    queried_passes = 0;
+}
+
+void renderer::attach_layer(int layer) {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layer_array, 0, layer);
+}
+
+//clears are scissored like everything else, cleared_pixels adds up what they touch
+void renderer::count_clear(int targets) {
+    cleared_pixels += static_cast<size_t>(scissor_rect.z) * scissor_rect.w * targets;
+}
+
+//pixel rectangle covering the sphere, the whole screen when part of it is behind the camera.
+//the corners of the sphere's bounding cube are projected and padded by a pixel against rounding
+glm::ivec4 projected_bounds(const glm::vec3& center, float radius, const glm::mat4& clip_matrix, int width, int height) {
+    glm::vec2 ndc_min(1.0f), ndc_max(-1.0f);
+
+    for (auto i = 0; i < 8; ++i) {
+        glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+        glm::vec4 clip = clip_matrix * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-5f)
+            return glm::ivec4(0, 0, width, height);
+
+        glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+        ndc_min = glm::min(ndc_min, ndc);
+        ndc_max = glm::max(ndc_max, ndc);
+    }
+
+    ndc_min = glm::clamp(ndc_min, -1.0f, 1.0f);
+    ndc_max = glm::clamp(ndc_max, -1.0f, 1.0f);
+    int x0 = std::max(0, static_cast<int>(std::floor((ndc_min.x * 0.5f + 0.5f) * width)) - 1);
+    int y0 = std::max(0, static_cast<int>(std::floor((ndc_min.y * 0.5f + 0.5f) * height)) - 1);
+    int x1 = std::min(width, static_cast<int>(std::ceil((ndc_max.x * 0.5f + 0.5f) * width)) + 1);
+    int y1 = std::min(height, static_cast<int>(std::ceil((ndc_max.y * 0.5f + 0.5f) * height)) + 1);
+
+    return glm::ivec4(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+}
+
+//reads finished peel queries between frames, true when the pass count changed and the frame is worth redrawing
+bool renderer::poll_peel_budget() {
+    int last_budget = peel_budget;
+    update_peel_budget();
+    return peel_budget != last_budget;
+}
+
+void renderer::render(scene& s, const glm::mat4& model_matrix, const glm::mat4& view, const glm::mat4& projection, unsigned int target_fbo) {
+    glViewport(0, 0, width, height);
+
+    scissor_rect = projected_bounds(s.centroid, s.radius, projection * view * model_matrix, width, height);
+    cleared_pixels = 0;
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(scissor_rect.x, scissor_rect.y, scissor_rect.z, scissor_rect.w);
+
+    main_shader.use();
+    main_shader.setMat4("model", model_matrix);
+    main_shader.setMat4("view", view);
+    main_shader.setMat4("projection", projection);
+    main_shader.setVec3("light_location", light_location);
+    main_shader.setVec2("screen_size", glm::vec2(width, height));
+    main_shader.setBool("first_pass", true);
+    main_shader.setBool("test_opaque", false);
+    main_shader.setInt("dual_peel", 0);
+    main_shader.setBool("weighted_blend", false);
+
+    //every layer is srgb, blending happens on linear color and writes are encoded
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    //the opaque depth is written below, it must not stay bound for sampling from the last frame
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClearDepth(1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+
+    //opaque meshes are drawn once into the base layer, it ends up behind every peeled layer
+    attach_layer(0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, opaque_depth, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    count_clear(2);
+    s.draw(main_shader, false);
+
+    //only translucent meshes are peeled, each peel also tests against the opaque depth
+    update_peel_budget();
+    int passes = s.has_translucent() ? std::min(peel_budget, pass_limit) : 0;
+    int layer_count = 1, queried = 0;
+    reused_passes = 0;
+
+    if (passes > 0) {
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, opaque_depth);
+        main_shader.setInt("opaque_depth", 4);
+        main_shader.setBool("test_opaque", true);
+
+        if (mode == dual_depth_peeling)
+            peel_dual(s, passes);
+        else if (mode == weighted_blended)
+            blend_weighted(s);
+        else if (mode == k_buffer)
+            blend_kbuffer(s);
+        else if (mode == cpu_sorted)
+            blend_sorted(s, view * model_matrix);
+        else
+            queried = peel_front_to_back(s, passes, model_matrix, view, projection);
+
+        if (mode == front_to_back_peeling)
+            layer_count = temporal_peeling ? 3 : 2;
+    }
+
+    queried_passes = mode == dual_depth_peeling ? passes : queried;
+    shade_queried = mode == front_to_back_peeling && shade_queries_supported && queried > 0;
+    peel_passes = passes;
+    last_view = view;
+
+    composite(target_fbo, layer_count);
+}
+
+//every peeled layer is blended under the layers in front of it as soon as it is peeled, so one scratch
+//layer and one accumulator, the second array layer, cover any pass count.
+//with reuse_transforms the vertices are transformed once per frame by transform feedback and every pass
+//fetches them, see vertex_feedback.hpp.
+//with temporal_peeling the first half of the passes accumulates into layer 2 and the rest into layer 1.
+//while the view moves a little per frame, frames alternate between peeling the front half and reprojecting
+//the back half, and reprojecting the front half and peeling the back half behind its reprojected last depth.
+//returns the passes that ran occlusion queries, only frames that peel every layer feed the peel budget
+int renderer::peel_front_to_back(scene& s, int passes, const glm::mat4& model_matrix, const glm::mat4& view, const glm::mat4& projection) {
+    const float accum_clear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glm::mat4 clip_matrix = projection * view * model_matrix;
+
+    attach_layer(1);
+    glClearBufferfv(GL_COLOR, 0, accum_clear);
+    count_clear(1);
+    if (temporal_peeling) {
+        attach_layer(2);
+        glClearBufferfv(GL_COLOR, 0, accum_clear);
+        count_clear(1);
+    }
+
+    //with reused transforms the passes run the fragment stage of main_shader behind a vertex fetch
+    Shader& peel_shader = reuse_transforms ? transformed_shader : main_shader;
+    if (reuse_transforms) {
+        capture_shader.use();
+        capture_shader.setMat4("model", model_matrix);
+        capture_shader.setMat4("view", view);
+        capture_shader.setMat4("projection", projection);
+        feedback.capture(s, capture_shader);
+
+        transformed_shader.use();
+        transformed_shader.setMat4("view", view);
+        transformed_shader.setVec3("light_location", light_location);
+        transformed_shader.setVec2("screen_size", glm::vec2(width, height));
+        transformed_shader.setBool("test_opaque", true);
+        transformed_shader.setInt("opaque_depth", 4);
+        transformed_shader.setInt("dual_peel", 0);
+        transformed_shader.setBool("weighted_blend", false);
+    }
+
+    if (!temporal_peeling) {
+        peel_layers(s, peel_shader, 0, passes, 0, 1, true, 0);
+        main_shader.use();
+        return passes;
+    }
+
+    int front_passes = (passes + 1) / 2;
+
+    //both halves are peeled and become the history
+    if (!temporal_view(view, passes)) {
+        peel_layers(s, peel_shader, 0, front_passes, 0, 2, true, history_front_depth);
+        save_peel_depth(history_split_depth);
+        save_layer(2, history_front);
+        peel_layers(s, peel_shader, front_passes, passes - front_passes, peel_depths[(front_passes + 1) % 2], 1, true, history_tail_depth);
+        save_layer(1, history_tail);
+
+        //none of the back half restarted at the front
+        const float start_clear[] = { 1.0f, 0.0f, 0.0f, 0.0f };
+        glBindFramebuffer(GL_FRAMEBUFFER, history_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, start_depth, 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glClearBufferfv(GL_COLOR, 0, start_clear);
+        glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+
+        front_clip = tail_clip = clip_matrix;
+        front_rect = tail_rect = scissor_rect;
+        history_valid = true;
+        history_passes = passes;
+        back_frame = false;
+        temporal_frames = 0;
+        main_shader.use();
+        return passes;
+    }
+
+    ++temporal_frames;
+    if (!back_frame) {
+        peel_layers(s, peel_shader, 0, front_passes, 0, 2, false, history_front_depth);
+        save_peel_depth(history_split_depth);
+        save_layer(2, history_front);
+        front_clip = clip_matrix;
+        front_rect = scissor_rect;
+
+        reproject_history(false, clip_matrix);
+        reused_passes = passes - front_passes;
+    }
+    else {
+        reproject_history(true, clip_matrix);
+        peel_layers(s, peel_shader, front_passes, passes - front_passes, start_depth, 1, false, history_tail_depth);
+        save_layer(1, history_tail);
+        tail_clip = clip_matrix;
+        tail_rect = scissor_rect;
+        reused_passes = front_passes;
+    }
+
+    back_frame = !back_frame;
+    main_shader.use();
+    return 0;
+}
+
+//history is only reused between nearby views of the same pass count. a view that did not move peels
+//everything, so the last frame of a drag is exact, and so does every temporal_full_interval-th frame
+//to keep the peel budget adapting
+bool renderer::temporal_view(const glm::mat4& view, int passes) const {
+    const int temporal_full_interval = 16;
+    if (!history_valid || passes != history_passes || passes < 2 || view == last_view)
+        return false;
+    if (temporal_frames >= temporal_full_interval)
+        return false;
+
+    //rotation angle between the views from the trace, and how far the eye moved against its distance
+    glm::mat4 delta = view * glm::inverse(last_view);
+    float cos_angle = (delta[0][0] + delta[1][1] + delta[2][2] - 1.0f) * 0.5f;
+    float max_angle = glm::radians(temporal_max_degrees);
+    float shift = glm::length(glm::vec3(delta[3]));
+
+    return cos_angle >= std::cos(max_angle) && shift <= max_angle * glm::length(glm::vec3(view[3]));
+}
+
+//peels count layers starting at pass first and under blends each one into accum_layer. the first pass
+//peels the nearest layer, or with a start depth the nearest one behind it. every pass with something
+//accumulated in front of it first stencils out the pixels whose accumulated alpha reached saturation_alpha,
+//their fragments are then rejected before shading and the under blend skips them too.
+//first_depth_history keeps the depth of the first pass for reprojecting the layers later
+void renderer::peel_layers(scene& s, Shader& peel_shader, int first, int count, unsigned int start, int accum_layer, bool query, unsigned int first_depth_history) {
+    int top_layer = temporal_peeling ? 2 : 1;
+
+    for (int i = 0; i < count; ++i) {
+        int pass = first + i;
+        unsigned int cur_depth = peel_depths[pass % 2];
+        unsigned int prev_depth = i == 0 ? start : peel_depths[(pass + 1) % 2];
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, peel_layer, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, cur_depth, 0);
+        glClearStencil(0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        count_clear(2);
+
+        if (prev_depth != 0) {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDepthMask(GL_FALSE);
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_ALWAYS, 1, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+            saturation_shader.use();
+            glActiveTexture(GL_TEXTURE7);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, layer_array);
+            saturation_shader.setInt("layers", 7);
+            saturation_shader.setInt("first_layer", accum_layer);
+            saturation_shader.setInt("last_layer", top_layer);
+            saturation_shader.setFloat("saturation_alpha", saturation_alpha);
+            glBindVertexArray(quad_vao);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            glBindVertexArray(0);
+
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthMask(GL_TRUE);
+            glEnable(GL_DEPTH_TEST);
+            glStencilFunc(GL_EQUAL, 0, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, prev_depth);
+            peel_shader.use();
+            peel_shader.setInt("prev_depth", 3);
+        }
+
+        peel_shader.use();
+        peel_shader.setBool("first_pass", prev_depth == 0);
+        if (query) {
+            glBeginQuery(GL_SAMPLES_PASSED, peel_queries[pass]);
+            if (shade_queries_supported)
+                glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, shade_queries[pass]);
+        }
+        if (reuse_transforms)
+            feedback.draw(peel_shader, 8);
+        else
+            s.draw(main_shader, true);
+        if (query) {
+            if (shade_queries_supported)
+                glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+
+        if (i == 0 && first_depth_history != 0)
+            save_peel_depth(first_depth_history);
+
+        //under blending: the new layer only shows through what the accumulator does not cover yet
+        attach_layer(accum_layer);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_FUNC_ADD);
+        glBlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+
+        dual_blend_shader.use();
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, peel_layer);
+        dual_blend_shader.setInt("back_layer", 5);
+        glBindVertexArray(quad_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    glDisable(GL_STENCIL_TEST);
+}
+
+//copies the depth of the pass just peeled, still attached to peel_fbo, into a history target
+//history_fbo has no color attachment during the copy, its draw buffer has to point at none or it is incomplete
+void renderer::save_peel_depth(unsigned int history_depth) {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, history_depth, 0);
+    glDrawBuffer(GL_NONE);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, peel_fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+}
+
+void renderer::save_layer(int layer, unsigned int history_color) {
+    attach_layer(layer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, history_color, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, peel_fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+}
+
+//warps the half peeled in an earlier frame into its accumulation layer for the current view.
+//back frames warp the front half into layer 2 and write start_depth for the back half's first pass,
+//front frames warp the back half into layer 1
+void renderer::reproject_history(bool back, const glm::mat4& clip_matrix) {
+    const unsigned int draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    const glm::mat4& history_clip = back ? front_clip : tail_clip;
+    const glm::ivec4& rect = back ? front_rect : tail_rect;
+
+    attach_layer(back ? 2 : 1);
+    if (back) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, start_depth, 0);
+        glDrawBuffers(2, draw_buffers);
+    }
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    reproject_shader.use();
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, back ? history_front : history_tail);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, back ? history_front_depth : history_tail_depth);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, back ? history_split_depth : start_depth);
+    reproject_shader.setInt("history_color", 5);
+    reproject_shader.setInt("history_depth", 6);
+    //back frames read the split depth there and front frames the start depth, never both
+    reproject_shader.setInt("history_split", 7);
+    reproject_shader.setInt("history_start", 7);
+    reproject_shader.setBool("back_frame", back);
+    reproject_shader.setMat4("history_to_current", clip_matrix * glm::inverse(history_clip));
+    reproject_shader.setVec4("history_rect", glm::vec4(rect.x / static_cast<float>(width), rect.y / static_cast<float>(height),
+        (rect.x + rect.z) / static_cast<float>(width), (rect.y + rect.w) / static_cast<float>(height)));
+    reproject_shader.setVec2("screen_size", glm::vec2(width, height));
+    reproject_shader.setFloat("depth_bias", temporal_depth_bias);
+    glBindVertexArray(quad_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    if (back) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    glEnable(GL_DEPTH_TEST);
+}
+
+//front layers are accumulated under each other, back layers are blended over the base layer as they come
+void renderer::peel_dual(scene& s, int passes) {
+    const unsigned int draw_buffers[] = {
+        GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+        GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5
+    };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dual_fbo);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+
+    //depth targets hold (-nearest, farthest) so both ends grow under max blending
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glClearColor(-1.0f, -1.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawBuffer(GL_COLOR_ATTACHMENT1);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    count_clear(2);
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glBlendEquation(GL_MAX);
+    main_shader.setInt("dual_peel", 1);
+    s.draw(main_shader, true);
+
+    main_shader.setInt("dual_peel", 2);
+    main_shader.setInt("prev_depth", 3);
+    main_shader.setInt("prev_front", 6);
+
+    for (int pass = 1; pass <= passes; ++pass) {
+        int cur = pass % 2, prev = 1 - cur;
+
+        glDrawBuffer(draw_buffers[cur * 3]);
+        glClearColor(-1.0f, -1.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawBuffers(2, &draw_buffers[cur * 3 + 1]);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        count_clear(3);
+
+        glDrawBuffers(3, &draw_buffers[cur * 3]);
+        glBlendEquation(GL_MAX);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, dual_depths[prev]);
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, dual_fronts[prev]);
+        main_shader.use();
+        s.draw(main_shader, true);
+
+        //any pixel with two or more layers left writes a back layer, so an empty back layer means this was the last pass
+        glDrawBuffer(GL_COLOR_ATTACHMENT6);
+        glBlendEquation(GL_FUNC_ADD);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        dual_blend_shader.use();
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, dual_back_temps[cur]);
+        dual_blend_shader.setInt("back_layer", 5);
+        glBindVertexArray(quad_vao);
+        glBeginQuery(GL_SAMPLES_PASSED, peel_queries[pass - 1]);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glEndQuery(GL_SAMPLES_PASSED);
+        glBindVertexArray(0);
+    }
+
+    //the accumulated front layers go over the base layer, which is then the only layer to composite
+    glDrawBuffer(GL_COLOR_ATTACHMENT6);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, dual_fronts[passes % 2]);
+    glBindVertexArray(quad_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    main_shader.use();
+    main_shader.setInt("dual_peel", 0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//one geometry pass: rgb sums weighted premultiplied color, alpha keeps the product of (1 - alpha)
+//and the second target sums the weights. glBlendFunci needs gl 4.0, so the revealage rides in the
+//accumulation alpha through glBlendFuncSeparate instead of a target of its own.
+//the resolve blends the weighted average over the base layer, which is then the only layer to composite
+void renderer::blend_weighted(scene& s) {
+    const unsigned int draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    const float accum_clear[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const float weight_clear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, weighted_fbo);
+    glDrawBuffers(2, draw_buffers);
+    glClearBufferfv(GL_COLOR, 0, accum_clear);
+    glClearBufferfv(GL_COLOR, 1, weight_clear);
+    count_clear(2);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    main_shader.setBool("test_opaque", false);
+    main_shader.setBool("weighted_blend", true);
+    s.draw(main_shader, true);
+    main_shader.setBool("weighted_blend", false);
+    glDepthMask(GL_TRUE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+    attach_layer(0);
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    weighted_resolve_shader.use();
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, weighted_accum);
+    weighted_resolve_shader.setInt("accum", 5);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, weighted_weight);
+    weighted_resolve_shader.setInt("weight", 6);
+    glBindVertexArray(quad_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    main_shader.use();
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//one pass appends every translucent fragment to its pixel's slots, the count image hands out slot indices.
+//the resolve sorts a pixel's fragments by depth and blends them front to back over the base layer
+void renderer::blend_kbuffer(scene& s) {
+    const unsigned int zero[] = { 0, 0, 0, 0 };
+
+    read_kbuffer_overflow();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, kbuffer_fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glClearBufferuiv(GL_COLOR, 0, zero);
+    count_clear(1);
+    glMemoryBarrier_(GL_FRAMEBUFFER_BARRIER_BIT);
+
+    //nothing is rasterized into the attachment, the shader only writes images
+    glDrawBuffer(GL_NONE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    glBindImageTexture_(0, kbuffer_count, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    glBindImageTexture_(1, kbuffer_fragments, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RG32UI);
+    main_shader.setInt("kbuffer_count", 0);
+    main_shader.setInt("kbuffer_fragments", 1);
+    main_shader.setInt("kbuffer_size", kbuffer_size);
+    main_shader.setBool("kbuffer_capture", true);
+    s.draw(main_shader, true);
+    main_shader.setBool("kbuffer_capture", false);
+
+    glMemoryBarrier_(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+    attach_layer(0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    unsigned int counter = kbuffer_counters[kbuffer_frame % 2];
+    unsigned int counter_zero = 0;
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter);
+    glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(unsigned int), &counter_zero);
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counter);
+
+    kbuffer_resolve_shader->use();
+    kbuffer_resolve_shader->setInt("kbuffer_count", 0);
+    kbuffer_resolve_shader->setInt("kbuffer_fragments", 1);
+    kbuffer_resolve_shader->setInt("kbuffer_size", kbuffer_size);
+    glBindVertexArray(quad_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    glMemoryBarrier_(GL_ATOMIC_COUNTER_BARRIER_BIT);
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, 0);
+    ++kbuffer_frame;
+
+    main_shader.use();
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//the sorted triangles are blended straight into the base layer, depth tested against the opaque depth
+//without writing it. the sort itself is skipped while the view and the selected lods stay the same
+void renderer::blend_sorted(scene& s, const glm::mat4& view_model) {
+    sorter.update(s, view_model);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, peel_fbo);
+    attach_layer(0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, opaque_depth, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    main_shader.setBool("test_opaque", false);
+    sorter.draw(main_shader);
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
+
+//reads the counter the previous frame's resolve wrote, so the readback does not wait on this frame
+void renderer::read_kbuffer_overflow() {
+    if (kbuffer_frame == 0)
+        return;
+
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, kbuffer_counters[(kbuffer_frame + 1) % 2]);
+    glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(unsigned int), &kbuffer_overflow_pixels);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+}
+
+//one pass over the layer array, front to back over a white background. the target is written as srgb,
+//which is a no-op for linear targets. outside the scissor rectangle the target is only cleared to white.
+//the target is output sized, layers rendered at a lower render_scale are stretched over it
+void renderer::composite(unsigned int target_fbo, int layer_count) {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
+    glViewport(0, 0, output_width, output_height);
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    cleared_pixels += static_cast<size_t>(output_width) * output_height * 2;
+
+    float scale_x = static_cast<float>(output_width) / width, scale_y = static_cast<float>(output_height) / height;
+    int x0 = static_cast<int>(std::floor(scissor_rect.x * scale_x)), y0 = static_cast<int>(std::floor(scissor_rect.y * scale_y));
+    int x1 = static_cast<int>(std::ceil((scissor_rect.x + scissor_rect.z) * scale_x));
+    int y1 = static_cast<int>(std::ceil((scissor_rect.y + scissor_rect.w) * scale_y));
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, x1 - x0, y1 - y0);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    screen_shader.use();
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, layer_array);
+    screen_shader.setInt("layers", 5);
+    screen_shader.setInt("layer_count", layer_count);
+    glBindVertexArray(quad_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    glDisable(GL_SCISSOR_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+#endif
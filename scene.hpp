@@ -0,0 +1,403 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <filesystem>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// a scene is a set of distinct models and the places they are drawn at,
+// a plain obj file is loaded as a scene with one model placed once.
+//
+// .scene files are plain text:
+//   model <name> <obj path relative to the scene file>
+//   place <name> <x> <y> <z> [<rot x> <rot y> <rot z> in degrees] [<scale>]
+
+class placement {
+public:
+    size_t model_index;
+    glm::mat4 transform;
+};
+
+class scene {
+public:
+    std::vector<model> models;
+    std::vector<placement> placements;
+    glm::vec3 centroid;
+    float radius;
+    size_t failed_models; //models that could not be parsed and were left out
+
+    scene() : centroid(0.0f), radius(0.0f), failed_models(0) {}
+    scene(const std::string& file_path, bool upload = true, parse_stream* stream = nullptr);
+    void parse_scene_file(const std::string& scene_file_path, std::vector<std::string>& model_paths);
+    void compute_bounds();
+    glm::mat4 framing_matrix() const;
+    void upload();
+    void setup_vertex_arrays();
+    void setup();
+    void select_lods(const glm::mat4& scene_matrix, const glm::vec3& eye, float pixels_per_unit, float max_pixel_error);
+    std::vector<size_t> lod_triangle_counts() const;
+    size_t selected_triangle_count() const;
+    size_t mesh_count() const;
+    size_t source_mesh_count() const;
+    size_t instancing_bytes_saved() const;
+    size_t vertex_buffer_bytes() const;
+    size_t gpu_bytes() const;
+    size_t ram_bytes() const;
+    void vertex_cache(vertex_cache_stats& before, vertex_cache_stats& after) const;
+    bool has_translucent() const;
+    void draw(Shader& shader, bool translucent);
+
+    scene(const scene&) = delete;
+    scene& operator=(const scene&) = delete;
+
+    scene(scene&& rhs) = default;
+    scene& operator=(scene&& rhs) = default;
+};
+
+bool is_scene_file(const std::string& file_path) {
+    return std::filesystem::path(file_path).extension() == ".scene";
+}
+
+void scene::parse_scene_file(const std::string& scene_file_path, std::vector<std::string>& model_paths) {
+    std::ifstream scene_file(scene_file_path);
+    std::string scene_file_line;
+    std::filesystem::path parent_dir = std::filesystem::path(scene_file_path).parent_path();
+    std::unordered_map<std::string, size_t> model_names;
+    std::unordered_map<std::string, size_t> path_indices;
+
+    if (!scene_file) {
+        std::cerr << "failed to open scene: " << scene_file_path << '\n';
+        return;
+    }
+
+    while (getline(scene_file, scene_file_line)) {
+        if (scene_file_line.empty())
+            continue;
+        size_t line_index = 0;
+        std::string line_type = get_line_type(scene_file_line, line_index);
+
+        if (line_type == "model") {
+            std::string name = get_line_type(scene_file_line, line_index);
+            size_t index_back = scene_file_line.size() - 1;
+            std::string path;
+
+            skip_white_space(scene_file_line, index_back, true);
+            for (; line_index <= index_back; ++line_index)
+                path += scene_file_line.at(line_index);
+
+            path = (parent_dir / path).lexically_normal().string();
+
+            //the same obj under two names is still loaded once
+            auto it = path_indices.emplace(path, model_paths.size());
+            if (it.second)
+                model_paths.push_back(path);
+            model_names[name] = it.first->second;
+        }
+        else if (line_type == "place") {
+            std::string name = get_line_type(scene_file_line, line_index);
+            auto it = model_names.find(name);
+
+            if (it == model_names.end()) {
+                std::cerr << "unknown model in scene: " << scene_file_line << '\n';
+                continue;
+            }
+
+            std::vector<float> values;
+            std::string num;
+            bool malformed = false;
+            scene_file_line += ' ';
+            for (; line_index < scene_file_line.size(); ++line_index) {
+                if (is_white_space(scene_file_line.at(line_index))) {
+                    if (!num.empty()) {
+                        char* end;
+                        values.push_back(std::strtof(num.c_str(), &end));
+                        malformed = malformed || *end != '\0';
+                    }
+                    num.clear();
+                }
+                else {
+                    num += scene_file_line.at(line_index);
+                }
+            }
+
+            //a position, then optionally a uniform scale, or a full rotation and optionally a scale
+            if (values.size() != 3 && values.size() != 4 && values.size() != 6 && values.size() != 7)
+                malformed = true;
+
+            if (malformed) {
+                scene_file_line.pop_back();
+                std::cerr << "malformed placement in scene: " << scene_file_line << '\n';
+                continue;
+            }
+
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(values[0], values[1], values[2]));
+
+            if (values.size() >= 6) {
+                transform = glm::rotate(transform, glm::radians(values[5]), glm::vec3(0.0f, 0.0f, 1.0f));
+                transform = glm::rotate(transform, glm::radians(values[4]), glm::vec3(0.0f, 1.0f, 0.0f));
+                transform = glm::rotate(transform, glm::radians(values[3]), glm::vec3(1.0f, 0.0f, 0.0f));
+            }
+
+            if (values.size() == 4 || values.size() >= 7)
+                transform = glm::scale(transform, glm::vec3(values.size() == 4 ? values[3] : values[6]));
+
+            placements.push_back({ it->second, transform });
+        }
+    }
+
+    //models that are declared but never placed are not loaded
+    std::vector<size_t> remap(model_paths.size(), SIZE_MAX);
+    std::vector<std::string> placed_paths;
+
+    for (auto& cur_placement : placements) {
+        if (remap[cur_placement.model_index] == SIZE_MAX) {
+            remap[cur_placement.model_index] = placed_paths.size();
+            placed_paths.push_back(model_paths[cur_placement.model_index]);
+        }
+        cur_placement.model_index = remap[cur_placement.model_index];
+    }
+
+    model_paths = std::move(placed_paths);
+}
+
+//upload = false leaves upload() and setup_vertex_arrays() to the caller, see scene_loader.hpp.
+//only a plain obj file is streamed, the models of a scene file parse in parallel and are placed afterwards
+scene::scene(const std::string& file_path, bool upload, parse_stream* stream) : centroid(0.0f), radius(0.0f), failed_models(0) {
+    std::vector<std::string> model_paths;
+
+    if (is_scene_file(file_path)) {
+        parse_scene_file(file_path, model_paths);
+    }
+    else {
+        model_paths.push_back(file_path);
+        placements.push_back({ 0, glm::mat4(1.0f) });
+    }
+
+    //a small task graph: every distinct obj is parsed by its own job, the bounds wait for all of them and
+    //the upload, pinned to this thread and its gl context, waits for the bounds. a model that fails to parse
+    //is reported and left out with its placements
+    std::vector<std::unique_ptr<model>> loaded(model_paths.size());
+    std::vector<job_handle> parsed;
+    parse_stream* model_stream = is_scene_file(file_path) ? nullptr : stream;
+
+    for (auto i = 0u; i < model_paths.size(); ++i) {
+        parsed.push_back(jobs().spawn("parse model", [&loaded, &model_paths, model_stream, i]() {
+            try {
+                loaded[i] = std::make_unique<model>(model_paths[i], false, model_stream);
+            }
+            catch (const std::exception& error) {
+                std::cerr << "failed to load " << model_paths[i] << ": " << error.what() << '\n';
+            }
+        }));
+    }
+
+    job_handle bounds = jobs().spawn("scene bounds", [this, &loaded]() {
+        std::vector<size_t> remap(loaded.size(), SIZE_MAX);
+        for (auto i = 0u; i < loaded.size(); ++i) {
+            if (loaded[i] == nullptr) {
+                ++failed_models;
+                continue;
+            }
+            remap[i] = models.size();
+            models.push_back(std::move(*loaded[i]));
+        }
+
+        placements.erase(std::remove_if(placements.begin(), placements.end(), [&remap](const placement& cur_placement) {
+            return remap[cur_placement.model_index] == SIZE_MAX;
+        }), placements.end());
+        for (auto& cur_placement : placements)
+            cur_placement.model_index = remap[cur_placement.model_index];
+
+        compute_bounds();
+    }, parsed);
+
+    job_handle finished = bounds;
+    if (upload)
+        finished = jobs().spawn_pinned("scene upload", [this]() { setup(); }, { bounds });
+
+    jobs().wait(finished);
+}
+
+//bounding sphere around every placed model sphere, this frames the scene instead of a single model centroid
+void scene::compute_bounds() {
+    if (placements.empty())
+        return;
+
+    glm::vec3 min_bound(FLT_MAX), max_bound(-FLT_MAX);
+    std::vector<glm::vec3> centers(placements.size());
+    std::vector<float> radii(placements.size());
+
+    for (auto i = 0u; i < placements.size(); ++i) {
+        const model& placed = models[placements[i].model_index];
+        const glm::mat4& transform = placements[i].transform;
+        float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+        centers[i] = glm::vec3(transform * glm::vec4(placed.centroid, 1.0f));
+        radii[i] = placed.radius * scale;
+
+        min_bound = glm::min(min_bound, centers[i] - glm::vec3(radii[i]));
+        max_bound = glm::max(max_bound, centers[i] + glm::vec3(radii[i]));
+    }
+
+    centroid = placements.size() == 1 ? centers[0] : (min_bound + max_bound) * 0.5f;
+    radius = 0.0f;
+    for (auto i = 0u; i < placements.size(); ++i)
+        radius = std::max(radius, glm::length(centers[i] - centroid) + radii[i]);
+}
+
+//scales the bounding sphere to radius 2 around the origin, a scene with nothing placed is left as it is
+glm::mat4 scene::framing_matrix() const {
+    glm::mat4 framing(1.0f);
+    if (!(radius > 0.0f))
+        return framing;
+
+    framing = glm::scale(framing, glm::vec3(2.0f / radius));
+    framing = glm::translate(framing, -centroid);
+    return framing;
+}
+
+void scene::upload() {
+    std::vector<std::vector<glm::mat4>> transforms(models.size());
+
+    for (auto& cur_placement : placements)
+        transforms[cur_placement.model_index].push_back(cur_placement.transform);
+
+    for (auto i = 0u; i < models.size(); ++i) {
+        models[i].set_placements(transforms[i]);
+        models[i].upload();
+    }
+}
+
+void scene::setup_vertex_arrays() {
+    for (auto& cur_model : models)
+        cur_model.setup_vertex_arrays();
+}
+
+void scene::setup() {
+    upload();
+    setup_vertex_arrays();
+}
+
+void scene::select_lods(const glm::mat4& scene_matrix, const glm::vec3& eye, float pixels_per_unit, float max_pixel_error) {
+    for (auto& cur_model : models)
+        cur_model.select_lods(scene_matrix, eye, pixels_per_unit, max_pixel_error);
+}
+
+std::vector<size_t> scene::lod_triangle_counts() const {
+    std::vector<size_t> counts;
+
+    for (auto& cur_model : models) {
+        std::vector<size_t> model_counts = cur_model.lod_triangle_counts();
+
+        if (counts.size() < model_counts.size())
+            counts.resize(model_counts.size(), counts.empty() ? 0 : counts.back());
+
+        for (auto i = 0u; i < counts.size(); ++i)
+            counts[i] += model_counts.empty() ? 0 : model_counts[std::min<size_t>(i, model_counts.size() - 1)];
+    }
+
+    return counts;
+}
+
+size_t scene::selected_triangle_count() const {
+    size_t count = 0;
+
+    for (auto& cur_model : models)
+        count += cur_model.selected_triangle_count();
+
+    return count;
+}
+
+size_t scene::mesh_count() const {
+    size_t count = 0;
+
+    for (auto& cur_model : models)
+        count += cur_model.meshes.size();
+
+    return count;
+}
+
+size_t scene::source_mesh_count() const {
+    size_t count = 0;
+
+    for (auto& cur_model : models)
+        count += cur_model.source_mesh_count;
+
+    return count;
+}
+
+size_t scene::instancing_bytes_saved() const {
+    size_t bytes = 0;
+
+    for (auto& cur_model : models)
+        bytes += cur_model.instancing_bytes_saved;
+
+    return bytes;
+}
+
+size_t scene::vertex_buffer_bytes() const {
+    size_t bytes = 0;
+
+    for (auto& cur_model : models)
+        bytes += cur_model.vertex_buffer_bytes();
+
+    return bytes;
+}
+
+size_t scene::gpu_bytes() const {
+    size_t bytes = 0;
+
+    for (auto& cur_model : models)
+        bytes += cur_model.gpu_bytes();
+
+    return bytes;
+}
+
+size_t scene::ram_bytes() const {
+    size_t bytes = 0;
+
+    for (auto& cur_model : models)
+        bytes += cur_model.ram_bytes();
+
+    return bytes;
+}
+
+void scene::vertex_cache(vertex_cache_stats& before, vertex_cache_stats& after) const {
+    before = vertex_cache_stats(); after = vertex_cache_stats();
+    float weight = 0.0f;
+
+    for (auto& cur_model : models) {
+        std::vector<size_t> counts = cur_model.lod_triangle_counts();
+        float w = counts.empty() ? 0.0f : static_cast<float>(counts[0]);
+
+        before.acmr += cur_model.cache_before.acmr * w; after.acmr += cur_model.cache_after.acmr * w;
+        before.atvr += cur_model.cache_before.atvr * w; after.atvr += cur_model.cache_after.atvr * w;
+        weight += w;
+    }
+
+    if (weight > 0.0f) {
+        before.acmr /= weight; after.acmr /= weight;
+        before.atvr /= weight; after.atvr /= weight;
+    }
+}
+
+bool scene::has_translucent() const {
+    for (auto& cur_model : models) {
+        if (cur_model.has_translucent())
+            return true;
+    }
+
+    return false;
+}
+
+void scene::draw(Shader& shader, bool translucent) {
+    for (auto& cur_model : models)
+        cur_model.draw(shader, translucent);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+// least recently used scenes up to a byte budget. the viewer keeps one for scenes that are set up on
+// the gpu, so switching back to one of them is only a swap, and the loader one for scenes that were
+// prefetched into ram but not uploaded yet. the cache only holds the scenes, evicted ones go back to
+// the owner, which knows on which thread they can be deleted
+
+//everything that changes what a load produces, scenes loaded with other options are not interchangeable.
+//the dialog and directory listings spell the same file differently, so paths are normalized
+std::string scene_cache_key(const std::string& path, const load_options& options) {
+    return std::filesystem::path(path).lexically_normal().make_preferred().string() + '|' + std::to_string(options.cache_flags() | (options.compact_vertices ? 8u : 0u));
+}
+
+class scene_cache {
+public:
+    size_t budget_bytes;
+
+    scene_cache(size_t budget_bytes) : budget_bytes(budget_bytes), total_bytes(0) {}
+
+    bool contains(const std::string& key) const;
+    std::unique_ptr<scene> take(const std::string& key);
+    //returns what had to be evicted to stay within the budget, a scene larger than the budget is evicted right away
+    std::vector<std::unique_ptr<scene>> insert(const std::string& key, std::unique_ptr<scene> cached, size_t bytes);
+    std::vector<std::unique_ptr<scene>> clear();
+    size_t size() const { return entries.size(); }
+    size_t bytes() const { return total_bytes; }
+
+private:
+    class entry {
+    public:
+        std::string key;
+        std::unique_ptr<scene> cached;
+        size_t bytes;
+    };
+
+    std::list<entry> entries; //most recently used first
+    size_t total_bytes;
+};
+
+bool scene_cache::contains(const std::string& key) const {
+    for (auto& cur_entry : entries) {
+        if (cur_entry.key == key)
+            return true;
+    }
+
+    return false;
+}
+
+std::unique_ptr<scene> scene_cache::take(const std::string& key) {
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+        if (i->key == key) {
+            std::unique_ptr<scene> taken = std::move(i->cached);
+            total_bytes -= i->bytes;
+            entries.erase(i);
+            return taken;
+        }
+    }
+
+    return nullptr;
+}
+
+std::vector<std::unique_ptr<scene>> scene_cache::insert(const std::string& key, std::unique_ptr<scene> cached, size_t bytes) {
+    std::vector<std::unique_ptr<scene>> evicted;
+
+    std::unique_ptr<scene> replaced = take(key);
+    if (replaced != nullptr)
+        evicted.push_back(std::move(replaced));
+
+    entries.push_front({ key, std::move(cached), bytes });
+    total_bytes += bytes;
+
+    while (total_bytes > budget_bytes && !entries.empty()) {
+        total_bytes -= entries.back().bytes;
+        evicted.push_back(std::move(entries.back().cached));
+        entries.pop_back();
+    }
+
+    return evicted;
+}
+
+std::vector<std::unique_ptr<scene>> scene_cache::clear() {
+    std::vector<std::unique_ptr<scene>> evicted;
+
+    for (auto& cur_entry : entries)
+        evicted.push_back(std::move(cur_entry.cached));
+    entries.clear();
+    total_bytes = 0;
+
+    return evicted;
+}
+
+#endif
@@ -0,0 +1,323 @@
+#ifndef SCENE_LOADER_HPP
+#define SCENE_LOADER_HPP
+
+#include <GLFW/glfw3.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <utility>
+#include <exception>
+#include <unordered_set>
+#include <algorithm>
+#include <filesystem>
+#include <condition_variable>
+#include "scene_cache.hpp"
+
+// loads a new scene while the render thread keeps drawing the current one. the worker owns a hidden
+// window whose context shares objects with the render context, it parses, uploads buffers and textures
+// there and puts a fence behind the uploads. the render thread takes the scene once that fence has
+// signaled, makes its vertex arrays, which are not shared between contexts, and swaps it in between
+// two frames. the scene it replaced is retired and deleted once the gpu is done with the frames that
+// drew it.
+// while nothing is requested the worker prefetches: it parses the given files into ram, a request for
+// one of them then only has to upload it. a prefetch runs as a background job, one at a time, so the
+// worker stays free for requests and their jobs go before it on the pool. a file that fails to prefetch
+// is not tried again until it is requested
+
+//up to count files with the same extension next to path in name order, nearest first, alternating after and before
+std::vector<std::string> neighbour_files(const std::string& path, size_t count) {
+    std::filesystem::path file(path);
+    std::vector<std::filesystem::path> siblings;
+    std::error_code error;
+
+    for (auto& entry : std::filesystem::directory_iterator(file.parent_path(), error)) {
+        if (entry.is_regular_file(error) && entry.path().extension() == file.extension())
+            siblings.push_back(entry.path());
+    }
+    std::sort(siblings.begin(), siblings.end());
+
+    auto it = std::find(siblings.begin(), siblings.end(), file.parent_path() / file.filename());
+    std::vector<std::string> neighbours;
+    if (it == siblings.end())
+        return neighbours;
+
+    size_t index = it - siblings.begin();
+    for (size_t step = 1; neighbours.size() < count && step < siblings.size(); ++step) {
+        if (index + step < siblings.size())
+            neighbours.push_back(siblings[index + step].string());
+        if (neighbours.size() < count && step <= index)
+            neighbours.push_back(siblings[index - step].string());
+    }
+
+    return neighbours;
+}
+
+class loaded_scene {
+public:
+    std::unique_ptr<scene> loaded;
+    std::string path, key;
+    bool current; //false when a newer request or a cancel came in while it loaded
+};
+
+class scene_loader {
+public:
+    //upload_window belongs to the window thread, it only has to share objects with the render context
+    scene_loader(GLFWwindow* upload_window, size_t prefetch_budget_bytes) : upload_window(upload_window), has_request(false), stopping(false),
+        uploading(false), prefetching(false), generation(0), upload_generation(0), prefetched(prefetch_budget_bytes) {
+        worker = std::thread([this]() { run(); });
+    }
+
+    //a newer request replaces one that has not started yet, a load already running still finishes.
+    //stream gets the triangles while the file parses, unless the file was prefetched
+    void request(const std::string& path, const load_options& options, std::shared_ptr<parse_stream> stream = nullptr);
+    void cancel();
+    void prefetch(const std::vector<std::string>& paths, const load_options& options);
+    bool loading();
+    bool take(loaded_scene& finished);
+    void retire(std::unique_ptr<scene> old_scene);
+    void collect_retired();
+    bool retired_pending() const { return !retired.empty(); }
+    size_t prefetched_count();
+
+    scene_loader(const scene_loader&) = delete;
+    scene_loader& operator=(const scene_loader&) = delete;
+
+    //has to run on the render thread, retired scenes still own vertex arrays of its context
+    ~scene_loader();
+
+private:
+    class pending_upload {
+    public:
+        std::unique_ptr<scene> loaded;
+        std::string path, key;
+        unsigned long long generation;
+        GLsync fence;
+    };
+
+    GLFWwindow* upload_window;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable requested;
+    bool has_request, stopping, uploading, prefetching;
+    unsigned long long generation, upload_generation; //generation counts requests and cancels
+    std::string request_path;
+    load_options request_options;
+    std::shared_ptr<parse_stream> request_stream;
+    std::deque<std::string> prefetch_paths;
+    load_options prefetch_options;
+    std::string prefetch_key; //of the prefetch job that is running
+    job_handle prefetch_job; //the last one started, worker only
+    std::unordered_set<std::string> prefetch_failed;
+    scene_cache prefetched; //parsed, not uploaded, so they can be deleted on any thread
+    std::vector<pending_upload> uploads; //in the order they were uploaded
+    std::vector<std::pair<std::unique_ptr<scene>, GLsync>> retired; //render thread only
+
+    void run();
+};
+
+void scene_loader::request(const std::string& path, const load_options& options, std::shared_ptr<parse_stream> stream) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request_path = path;
+        request_options = options;
+        request_stream = stream;
+        has_request = true;
+        ++generation;
+    }
+    requested.notify_one();
+}
+
+//a load still running is not swapped in when it finishes, it only ends up in the cache
+void scene_loader::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    has_request = false;
+    request_stream.reset();
+    ++generation;
+}
+
+//replaces the files still waiting to be prefetched
+void scene_loader::prefetch(const std::vector<std::string>& paths, const load_options& options) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        prefetch_paths.assign(paths.begin(), paths.end());
+        prefetch_options = options;
+    }
+    requested.notify_one();
+}
+
+//true until the last requested scene can be taken
+bool scene_loader::loading() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (has_request || (uploading && upload_generation == generation))
+        return true;
+
+    for (auto& cur_upload : uploads) {
+        if (cur_upload.generation == generation)
+            return true;
+    }
+
+    return false;
+}
+
+//false until an uploaded scene is resident on the gpu, polling never blocks the render thread
+bool scene_loader::take(loaded_scene& finished) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (uploads.empty())
+            return false;
+
+        //uploads finish in order, the first one that has not signaled holds back the rest
+        pending_upload& first = uploads.front();
+        GLenum status = glClientWaitSync(first.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+
+        glDeleteSync(first.fence);
+        finished.loaded = std::move(first.loaded);
+        finished.path = first.path;
+        finished.key = first.key;
+        finished.current = first.generation == generation;
+        uploads.erase(uploads.begin());
+    }
+
+    finished.loaded->setup_vertex_arrays();
+    return true;
+}
+
+//the fence follows every frame submitted so far, all that can still read the old scene
+void scene_loader::retire(std::unique_ptr<scene> old_scene) {
+    retired.push_back({ std::move(old_scene), glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+}
+
+void scene_loader::collect_retired() {
+    for (auto i = retired.begin(); i != retired.end();) {
+        GLenum status = glClientWaitSync(i->second, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glDeleteSync(i->second);
+            i = retired.erase(i);
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+size_t scene_loader::prefetched_count() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return prefetched.size();
+}
+
+//requests go first, the worker only starts a prefetch while none is waiting
+void scene_loader::run() {
+    glfwMakeContextCurrent(upload_window);
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        requested.wait(lock, [this]() { return has_request || (!prefetching && !prefetch_paths.empty()) || stopping; });
+        if (stopping)
+            break;
+
+        if (has_request) {
+            //the running prefetch reads loader_opts as well. a request for the same file waits for it
+            //instead of parsing it twice, one with other options waits before it changes them
+            std::string key = scene_cache_key(request_path, request_options);
+            bool same_options = request_options.cache_flags() == loader_opts.cache_flags() && request_options.compact_vertices == loader_opts.compact_vertices;
+            if (prefetching && (key == prefetch_key || !same_options)) {
+                requested.wait(lock, [this]() { return !prefetching || stopping; });
+                continue;
+            }
+
+            std::string path = request_path;
+            load_options options = request_options;
+            std::shared_ptr<parse_stream> stream = std::move(request_stream);
+            std::unique_ptr<scene> loaded = prefetched.take(key);
+            bool set_options = !prefetching;
+            has_request = false;
+            uploading = true;
+            upload_generation = generation;
+            lock.unlock();
+
+            //only this thread writes the options once the viewer is running
+            if (set_options)
+                loader_opts = options;
+            if (loaded == nullptr)
+                loaded = std::make_unique<scene>(path, false, stream.get());
+            loaded->upload();
+
+            //flushed so the fence reaches the gpu, otherwise the render context could wait on it forever
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            lock.lock();
+            uploading = false;
+            uploads.push_back({ std::move(loaded), path, key, upload_generation, fence });
+        }
+        else {
+            std::string path = prefetch_paths.front();
+            load_options options = prefetch_options;
+            std::string key = scene_cache_key(path, options);
+            prefetch_paths.pop_front();
+            if (prefetched.contains(key) || prefetch_failed.count(key) > 0)
+                continue;
+
+            //no job reads loader_opts while no prefetch is running and the worker is here
+            loader_opts = options;
+            prefetching = true;
+            prefetch_key = key;
+
+            //its jobs only run on idle workers, never inside a job that waits on a requested load.
+            //evicted scenes were never uploaded, dropping them there makes no gl calls. the notify happens
+            //under the lock, the destructor must not see prefetching cleared while this still uses requested
+            prefetch_job = jobs().spawn_background("prefetch scene", [this, path, key]() {
+                std::unique_ptr<scene> parsed;
+                try {
+                    parsed = std::make_unique<scene>(path, false);
+                    if (parsed->failed_models > 0)
+                        parsed.reset();
+                }
+                catch (const std::exception&) {
+                    parsed.reset();
+                }
+                size_t bytes = parsed != nullptr ? parsed->ram_bytes() : 0;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (parsed != nullptr)
+                    prefetched.insert(key, std::move(parsed), bytes);
+                else
+                    prefetch_failed.insert(key);
+                prefetching = false;
+                requested.notify_all();
+            });
+        }
+    }
+
+    lock.unlock();
+    glfwMakeContextCurrent(NULL);
+}
+
+//a load or prefetch in progress is finished before the worker stops, its scene is dropped with the rest
+scene_loader::~scene_loader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    requested.notify_all();
+    worker.join();
+
+    if (prefetch_job != nullptr)
+        jobs().wait(prefetch_job);
+
+    for (auto& cur_upload : uploads)
+        glDeleteSync(cur_upload.fence);
+    uploads.clear();
+
+    glFinish();
+    for (auto& entry : retired)
+        glDeleteSync(entry.second);
+    retired.clear();
+}
+
+#endif
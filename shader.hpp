@@ -5,6 +5,7 @@
 
 #include <glad/glad.h>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <glm/glm.hpp>
@@ -31,11 +32,19 @@ void checkShaderLinkage(unsigned int shaderProgram) {
     }
 }
 
+std::string readShaderFile(const char* path) {
+    std::ifstream shaderFile(path);
+    std::stringstream shaderStream;
+    shaderStream << shaderFile.rdbuf();
+    return shaderStream.str();
+}
+
 class Shader {
 public:
     unsigned int ID;
 
     Shader(const char* vertexPath, const char* fragmentPath);
+    Shader(const char* vertexPath, const std::vector<std::string>& feedbackVaryings);
 
     void use();
     void setBool(const std::string& name, bool value) const;
@@ -44,6 +53,7 @@ public:
     void setMat4(const std::string& name, glm::mat4 value) const;
     void setVec3(const std::string& name, glm::vec3 value) const;
     void setVec2(const std::string& name, glm::vec2 value) const;
+    void setVec4(const std::string& name, glm::vec4 value) const;
 };
 
 Shader::Shader(const char* vertexPath, const char* fragmentPath) {
@@ -91,6 +101,29 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 
 }
 
+//vertex only program for transform feedback, the varyings are captured interleaved in the given order
+Shader::Shader(const char* vertexPath, const std::vector<std::string>& feedbackVaryings) {
+    std::string vertexCode = readShaderFile(vertexPath);
+    const char* vShaderCode = vertexCode.c_str();
+
+    unsigned int vId = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vId, 1, &vShaderCode, NULL);
+    glCompileShader(vId);
+    checkShaderCompilation(vId);
+
+    std::vector<const char*> varyings;
+    for (auto& varying : feedbackVaryings)
+        varyings.push_back(varying.c_str());
+
+    ID = glCreateProgram();
+    glAttachShader(ID, vId);
+    glTransformFeedbackVaryings(ID, static_cast<int>(varyings.size()), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(ID);
+    checkShaderLinkage(ID);
+
+    glDeleteShader(vId);
+}
+
 void Shader::use() {
     glUseProgram(ID);
 }
@@ -123,4 +156,9 @@ void Shader::setVec2(const std::string& name, glm::vec2 value) const
     glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
 }
 
+void Shader::setVec4(const std::string& name, glm::vec4 value) const
+{
+    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D back_layer;
+
+// passes a premultiplied layer through to the blender, empty texels are skipped
+void main()
+{
+    FragColor = texture(back_layer, TexCoords);
+    if(FragColor.a == 0.0)
+        discard;
+}
@@ -0,0 +1,52 @@
+#version 420 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+layout(r32ui) readonly uniform uimage2D kbuffer_count;
+layout(rg32ui) readonly uniform uimage2DArray kbuffer_fragments;
+uniform int kbuffer_size;
+layout(binding = 0, offset = 0) uniform atomic_uint overflow_pixels;
+
+const int max_kbuffer_size = 16;
+
+vec4 unpack_color(uint packed){
+    vec4 color = vec4(packed & 255u, (packed >> 8) & 255u, (packed >> 16) & 255u, packed >> 24) / 255.0;
+    return vec4(pow(color.rgb, vec3(2.2)), color.a);
+}
+
+// sorts the stored fragments nearest first and blends them front to back, premultiplied
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    uint count = imageLoad(kbuffer_count, coord).r;
+    if(count == 0u)
+        discard;
+
+    if(count > uint(kbuffer_size))
+        atomicCounterIncrement(overflow_pixels);
+
+    int stored = min(int(count), min(kbuffer_size, max_kbuffer_size));
+    uvec2 fragments[max_kbuffer_size];
+    for(int i = 0; i < stored; ++i)
+        fragments[i] = imageLoad(kbuffer_fragments, ivec3(coord, i)).rg;
+
+    for(int i = 1; i < stored; ++i){
+        uvec2 fragment = fragments[i];
+        int j = i - 1;
+        while(j >= 0 && uintBitsToFloat(fragments[j].x) > uintBitsToFloat(fragment.x)){
+            fragments[j + 1] = fragments[j];
+            --j;
+        }
+        fragments[j + 1] = fragment;
+    }
+
+    vec4 result = vec4(0.0);
+    for(int i = 0; i < stored; ++i){
+        vec4 color = unpack_color(fragments[i].y);
+        result.rgb += color.rgb * (1.0 - result.a);
+        result.a += color.a * (1.0 - result.a);
+    }
+
+    FragColor = result;
+}
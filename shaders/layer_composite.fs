@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D screenTexture;
+
+// the composite before layer arrays, kept for the composite benchmark: one draw per layer, gamma per layer
+void main()
+{
+    vec4 back = texture(screenTexture, TexCoords);
+    FragColor = vec4(pow(back.rgb, vec3(1.0/2.2)), back.a);
+
+} 
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+uniform sampler2DArray layers;
+uniform int first_layer;
+uniform int last_layer;
+uniform float saturation_alpha;
+
+// only pixels the accumulated layers already cover together survive and get stenciled
+void main()
+{
+    float transmittance = 1.0;
+    for(int i = first_layer; i <= last_layer; ++i){
+        transmittance *= 1.0 - texture(layers, vec3(TexCoords, float(i))).a;
+    }
+
+    if(1.0 - transmittance < saturation_alpha)
+        discard;
+}
@@ -3,12 +3,15 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D screenTexture;
-uniform vec2 screen_size;
+uniform sampler2DArray layers;
+uniform int layer_count;
 
+// layers are stored back to front with premultiplied linear color, the output is opaque over white
 void main()
 {
-    vec4 back = texture(screenTexture, TexCoords);
-    FragColor = vec4(pow(back.rgb, vec3(1.0/2.2)), back.a);
-
-} 
\ No newline at end of file
+    vec4 color = vec4(0.0);
+    for(int i = layer_count - 1; i >= 0 && color.a < 1.0; --i){
+        color += (1.0 - color.a) * texture(layers, vec3(TexCoords, float(i)));
+    }
+    FragColor = vec4(color.rgb + (1.0 - color.a), 1.0);
+}
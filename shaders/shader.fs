@@ -1,5 +1,6 @@
 #version 330 core
-out vec4 FragColor;
+#extension GL_ARB_shader_image_load_store : enable
+layout(location = 0) out vec4 FragColor;
 
 in VS_OUT{
     vec3 frag_pos;
@@ -28,29 +29,49 @@ uniform material mat;
 uniform vec3 view_pos;
 uniform bool first_pass;
 uniform sampler2D prev_depth;
+uniform bool test_opaque;
+uniform sampler2D opaque_depth;
 uniform vec2 screen_size;
 
-void main(){
-    if(!first_pass){
-        if(gl_FragCoord.z <= texture(prev_depth,( gl_FragCoord.xy / screen_size)).r){
-            discard;
-        }
-    }
-
-    float alpha;
-
+// dual depth peeling: 1 writes (-nearest, farthest) into location 0, 2 peels both ends against
+// prev_depth, adding the nearest layer under prev_front and writing the farthest to location 2
+uniform int dual_peel;
+uniform sampler2D prev_front;
+layout(location = 1) out vec4 front_color;
+layout(location = 2) out vec4 back_color;
+
+// weighted blended transparency: location 0 gets weighted premultiplied color, location 1 the weight
+uniform bool weighted_blend;
+
+// k-buffer capture, only compiled where image load/store exists: every fragment takes the next slot
+// of its pixel from kbuffer_count and stores its depth and color there, slots past kbuffer_size are dropped
+#ifdef GL_ARB_shader_image_load_store
+uniform bool kbuffer_capture;
+uniform int kbuffer_size;
+layout(r32ui) coherent uniform uimage2D kbuffer_count;
+layout(rg32ui) writeonly uniform uimage2DArray kbuffer_fragments;
+
+//gamma encoded so 8 bits per channel keep the dark shades
+uint pack_color(vec4 color){
+    uvec4 c = uvec4(clamp(vec4(pow(color.rgb, vec3(1.0 / 2.2)), color.a), 0.0, 1.0) * 255.0 + 0.5);
+    return c.r | (c.g << 8) | (c.b << 16) | (c.a << 24);
+}
+#endif
+
+//depth weight from McGuire and Bavoil 2013, nearer and more opaque fragments count more
+float blend_weight(float alpha){
+    float z = gl_FragCoord.z;
+    return clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - z * 0.9, 3.0), 1e-2, 3e3);
+}
+
+float frag_alpha(){
     if(mat.has_alpha_value){
-        alpha = texture(mat.diffuse_map, fs_in.tex_coord).a;
-        
-    }
-    else{
-        alpha = mat.d;
+        return texture(mat.diffuse_map, fs_in.tex_coord).a;
     }
+    return mat.d;
+}
 
-    if(alpha < 0.1){
-            discard;
-        }
-
+vec4 shade(float alpha){
     vec3 color;
     if(!mat.has_kd_map){
         color = mat.kd;
@@ -82,5 +103,92 @@ void main(){
 
 
     vec3 color_final = (ambient + diffuse + specular);
-    FragColor = vec4(color_final * alpha, alpha);
+    return vec4(color_final * alpha, alpha);
+}
+
+void dual_peel_fragment(float alpha){
+    vec2 screen_uv = gl_FragCoord.xy / screen_size;
+    vec2 depth_range = texture(prev_depth, screen_uv).rg;
+    vec4 front = texture(prev_front, screen_uv);
+    float nearest = -depth_range.x;
+    float farthest = depth_range.y;
+    float depth = gl_FragCoord.z;
+
+    //targets are max blended, depth and front only grow so they pass through unless changed
+    FragColor = vec4(-1.0, -1.0, 0.0, 0.0);
+    front_color = front;
+    back_color = vec4(0.0);
+
+    //already peeled
+    if(depth < nearest || depth > farthest){
+        return;
+    }
+
+    //still inside, peel it in a later pass
+    if(depth > nearest && depth < farthest){
+        FragColor.rg = vec2(-depth, depth);
+        return;
+    }
+
+    vec4 color = shade(alpha);
+    if(depth == nearest){
+        float transmittance = 1.0 - front.a;
+        front_color.rgb += color.rgb * transmittance;
+        front_color.a = 1.0 - transmittance * (1.0 - color.a);
+    }
+    else{
+        back_color = color;
+    }
+}
+
+void main(){
+    //translucent surfaces hidden behind the opaque base layer are never peeled
+    if(test_opaque){
+        if(gl_FragCoord.z >= texture(opaque_depth, (gl_FragCoord.xy / screen_size)).r){
+            discard;
+        }
+    }
+
+    float alpha = frag_alpha();
+
+    if(alpha < 0.1){
+            discard;
+        }
+
+#ifdef GL_ARB_shader_image_load_store
+    if(kbuffer_capture){
+        ivec2 coord = ivec2(gl_FragCoord.xy);
+        uint slot = imageAtomicAdd(kbuffer_count, coord, 1u);
+        if(slot < uint(kbuffer_size)){
+            imageStore(kbuffer_fragments, ivec3(coord, int(slot)), uvec4(floatBitsToUint(gl_FragCoord.z), pack_color(shade(alpha)), 0u, 0u));
+        }
+        discard;
+    }
+#endif
+
+    if(weighted_blend){
+        vec4 color = shade(alpha);
+        float weight = blend_weight(alpha);
+        FragColor = vec4(color.rgb * weight, color.a);
+        front_color = vec4(color.a * weight);
+        return;
+    }
+
+    if(dual_peel == 1){
+        FragColor = vec4(-gl_FragCoord.z, gl_FragCoord.z, 0.0, 0.0);
+        return;
+    }
+
+    if(dual_peel == 2){
+        dual_peel_fragment(alpha);
+        return;
+    }
+
+    if(!first_pass){
+        if(gl_FragCoord.z <= texture(prev_depth,( gl_FragCoord.xy / screen_size)).r){
+            discard;
+        }
+    }
+
+    FragColor = shade(alpha);
 }
\ No newline at end of file
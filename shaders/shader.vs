@@ -2,6 +2,7 @@
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec2 tex;
 layout (location = 2) in vec3 norm;
+layout (location = 3) in mat4 instance_model;
 
 out VS_OUT{
     vec3 frag_pos;
@@ -16,11 +17,28 @@ uniform mat4 view;
 uniform vec3 light_location;
 uniform mat4 lightSpaceMatrix;
 
+// compact vertices: pos is unorm16 inside the mesh bounds, norm.xy is an octahedral normal
+uniform bool compact_vertices;
+uniform vec3 pos_scale;
+uniform vec3 pos_offset;
+
+vec3 oct_decode(vec2 e){
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main(){
-    vec4 frag_model_space = model * vec4(pos, 1.0);
+    vec3 position = compact_vertices ? pos * pos_scale + pos_offset : pos;
+    vec3 normal = compact_vertices ? oct_decode(norm.xy) : norm;
+
+    mat4 world = model * instance_model;
+    vec4 frag_model_space = world * vec4(position, 1.0);
     vs_out.frag_pos = vec3(view * frag_model_space);
     vs_out.tex_coord = tex;
-    vs_out.normal = mat3(transpose(inverse(view * model))) * norm;
+    vs_out.normal = mat3(transpose(inverse(view * world))) * normal;
     vs_out.light_pos = vec3(view *  vec4(light_location, 1.0));
-    gl_Position = projection * view * model * vec4(pos, 1.0);
+    gl_Position = projection * view * frag_model_space;
 }
\ No newline at end of file
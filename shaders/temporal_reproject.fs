@@ -0,0 +1,74 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float start_depth;
+
+in vec2 TexCoords;
+
+uniform sampler2D history_color;
+uniform sampler2D history_depth;
+uniform sampler2D history_split;
+uniform sampler2D history_start;
+uniform bool back_frame;
+uniform mat4 history_to_current;
+uniform vec4 history_rect;
+uniform vec2 screen_size;
+uniform float depth_bias;
+
+// finds the texel of an earlier frame whose surface lands on this pixel now, by following the motion of
+// the surface under the current guess. false where there is no surface or the search does not converge,
+// which is where the surface was hidden or off screen in that frame
+bool find_history(sampler2D depth_tex, out vec2 q, out float depth){
+    q = TexCoords;
+    for(int i = 0; i < 4; ++i){
+        q = (floor(q * screen_size) + 0.5) / screen_size;
+        if(any(lessThan(q, history_rect.xy)) || any(greaterThanEqual(q, history_rect.zw)))
+            return false;
+
+        float d = texture(depth_tex, q).r;
+        if(d >= 1.0)
+            return false;
+
+        vec4 clip = history_to_current * vec4(vec3(q, d) * 2.0 - 1.0, 1.0);
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 error = TexCoords - (ndc.xy * 0.5 + 0.5);
+        depth = ndc.z * 0.5 + 0.5;
+        if(all(lessThanEqual(abs(error) * screen_size, vec2(1.0))))
+            return true;
+        q += error;
+    }
+    return false;
+}
+
+// back frames warp the front half and write the depth the tail peel starts behind, 0 restarts it at the
+// front where the front history is invalid. front frames warp the tail, except where it was restarted
+void main()
+{
+    vec2 q;
+    float depth;
+    FragColor = vec4(0.0);
+    start_depth = 0.0;
+
+    if(!find_history(history_depth, q, depth))
+        return;
+
+    if(!back_frame){
+        if(texture(history_start, q).r > 0.0)
+            FragColor = texture(history_color, q);
+        return;
+    }
+
+    //the front half already peeled every layer here
+    if(texture(history_split, q).r >= 1.0){
+        FragColor = texture(history_color, q);
+        start_depth = 1.0;
+        return;
+    }
+
+    vec2 split_q;
+    float split_depth;
+    if(!find_history(history_split, split_q, split_depth))
+        return;
+
+    FragColor = texture(history_color, q);
+    start_depth = split_depth + depth_bias;
+}
@@ -0,0 +1,38 @@
+#version 330 core
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec2 tex;
+layout (location = 2) in vec3 norm;
+layout (location = 3) in mat4 instance_model;
+
+// transform feedback pre-pass: the same transform as shader.vs, run once per vertex and instance per frame.
+// three vec4 per vertex, the texture coordinate rides in the w of the other two
+out vec4 clip_position;
+out vec4 view_position;
+out vec4 view_normal;
+
+uniform mat4 model;
+uniform mat4 projection;
+uniform mat4 view;
+
+uniform bool compact_vertices;
+uniform vec3 pos_scale;
+uniform vec3 pos_offset;
+
+vec3 oct_decode(vec2 e){
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main(){
+    vec3 position = compact_vertices ? pos * pos_scale + pos_offset : pos;
+    vec3 normal = compact_vertices ? oct_decode(norm.xy) : norm;
+
+    mat4 world = model * instance_model;
+    vec4 frag_model_space = world * vec4(position, 1.0);
+    view_position = vec4(vec3(view * frag_model_space), tex.x);
+    view_normal = vec4(mat3(transpose(inverse(view * world))) * normal, tex.y);
+    clip_position = projection * view * frag_model_space;
+}
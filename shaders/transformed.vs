@@ -0,0 +1,29 @@
+#version 330 core
+
+out VS_OUT{
+    vec3 frag_pos;
+    vec2 tex_coord;
+    vec3 normal;
+    vec3 light_pos;
+} vs_out;
+
+// pass-through for vertices transform_capture.vs already transformed this frame,
+// instance i of a mesh starts vertex_count vertices after instance i - 1
+uniform samplerBuffer transformed_vertices;
+uniform int vertex_base;
+uniform int vertex_count;
+uniform mat4 view;
+uniform vec3 light_location;
+
+void main(){
+    int texel = (vertex_base + gl_InstanceID * vertex_count + gl_VertexID) * 3;
+    vec4 clip_position = texelFetch(transformed_vertices, texel);
+    vec4 view_position = texelFetch(transformed_vertices, texel + 1);
+    vec4 view_normal = texelFetch(transformed_vertices, texel + 2);
+
+    vs_out.frag_pos = view_position.xyz;
+    vs_out.tex_coord = vec2(view_position.w, view_normal.w);
+    vs_out.normal = view_normal.xyz;
+    vs_out.light_pos = vec3(view * vec4(light_location, 1.0));
+    gl_Position = clip_position;
+}
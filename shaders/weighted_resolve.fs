@@ -0,0 +1,19 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D accum;
+uniform sampler2D weight;
+
+// weighted average of the translucent colors, covering 1 - revealage of the pixel, premultiplied
+void main()
+{
+    vec4 sum = texture(accum, TexCoords);
+    float revealage = sum.a;
+    if(revealage >= 1.0)
+        discard;
+
+    vec3 average = sum.rgb / max(texture(weight, TexCoords).r, 1e-5);
+    FragColor = vec4(average * (1.0 - revealage), 1.0 - revealage);
+}
@@ -0,0 +1,153 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <GLFW/glfw3.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+// frame statistics, shown in the window title twice a second. the title is set by the window thread,
+// end_frame only says when a new one is due
+
+std::string format_count(size_t count) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+
+    if (count >= 1000000)
+        out << count / 1000000.0 << "M";
+    else if (count >= 1000)
+        out << count / 1000.0 << "k";
+    else
+        out << count;
+
+    return out.str();
+}
+
+class viewer_stats {
+public:
+    double frame_ms;
+    double input_latency_ms; //oldest input in the frame to its present
+    size_t drawn_triangles;
+    std::vector<size_t> lod_triangles;
+    size_t unique_meshes, source_meshes, instancing_bytes_saved;
+    size_t models, placements;
+    size_t vertex_bytes;
+    float acmr_before, acmr_after;
+    int peel_layers;
+    int reused_layers;
+    std::string transparency;
+    size_t transparency_bytes;
+    size_t overflow_pixels;
+    size_t sorted_triangles;
+    double sort_ms;
+    size_t cleared_pixels;
+    std::vector<unsigned int> layer_fragments;
+    std::string quality; //quality governor decisions, empty at full quality
+    std::string loading; //file of the scene loading in the background, empty when none is
+    size_t loading_bytes, loading_total_bytes, streamed_triangles; //progress of a streamed load
+    size_t cached_scenes, cached_bytes, prefetched_scenes;
+    std::string io_backend;
+    size_t io_queue_depth, io_bytes_in_flight; //asset files still reading
+
+    viewer_stats() : frame_ms(0.0), input_latency_ms(0.0), drawn_triangles(0), unique_meshes(0), source_meshes(0), instancing_bytes_saved(0),
+        models(0), placements(0), vertex_bytes(0), acmr_before(0.0f), acmr_after(0.0f), peel_layers(0), reused_layers(0), transparency_bytes(0), overflow_pixels(0), sorted_triangles(0), sort_ms(0.0), cleared_pixels(0), loading_bytes(0), loading_total_bytes(0), streamed_triangles(0), cached_scenes(0), cached_bytes(0), prefetched_scenes(0), io_queue_depth(0), io_bytes_in_flight(0), frame_start_time(0.0), last_report_time(0.0) {
+    }
+
+    void begin_frame();
+    bool end_frame();
+    void report_next() { last_report_time = 0.0; }
+    std::string title() const { return "Hamood_Viewer | " + summary(); }
+    std::string summary() const;
+
+private:
+    double frame_start_time, last_report_time;
+};
+
+//frames are only rendered on demand, so frame time is measured from the start of a frame rather than between frames
+void viewer_stats::begin_frame() {
+    frame_start_time = glfwGetTime();
+}
+
+//true twice a second, when the title should show the new numbers
+bool viewer_stats::end_frame() {
+    double now = glfwGetTime();
+    frame_ms = (now - frame_start_time) * 1000.0;
+
+    if (now - last_report_time < 0.5)
+        return false;
+
+    last_report_time = now;
+    return true;
+}
+
+std::string viewer_stats::summary() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << frame_ms << " ms";
+    if (input_latency_ms > 0.0)
+        out << " (input " << input_latency_ms << " ms)";
+    out << " | tris " << format_count(drawn_triangles);
+
+    if (!loading.empty())
+        out << " | loading " << loading;
+
+    if (loading_total_bytes > 0) {
+        out << " " << format_count(loading_bytes) << "B/" << format_count(loading_total_bytes) << "B parsed, ";
+        out << format_count(streamed_triangles) << " tris resident";
+    }
+
+    if (io_queue_depth > 0)
+        out << " | " << io_backend << " " << io_queue_depth << " files " << format_count(io_bytes_in_flight) << "B in flight";
+
+    out << " | vtx " << format_count(vertex_bytes) << "B";
+
+    if (peel_layers > 0)
+        out << " | " << transparency << " " << peel_layers << " (" << format_count(transparency_bytes) << "B)";
+
+    if (reused_layers > 0)
+        out << " reprojected " << reused_layers;
+
+    if (peel_layers > 0 && !layer_fragments.empty()) {
+        out << " frags";
+        for (auto i = 0u; i < layer_fragments.size(); ++i)
+            out << (i == 0 ? " " : "/") << format_count(layer_fragments[i]);
+    }
+
+    if (overflow_pixels > 0)
+        out << " overflow " << format_count(overflow_pixels) << " px";
+
+    if (sorted_triangles > 0)
+        out << " sorted " << format_count(sorted_triangles) << " in " << sort_ms << " ms";
+
+    if (!quality.empty())
+        out << " | " << quality;
+
+    if (cleared_pixels > 0)
+        out << " | cleared " << format_count(cleared_pixels) << " px";
+
+    if (acmr_after > 0.0f)
+        out << std::setprecision(2) << " | acmr " << acmr_before << "->" << acmr_after << std::setprecision(1);
+
+    if (cached_scenes > 0 || prefetched_scenes > 0)
+        out << " | cached " << cached_scenes << " (" << format_count(cached_bytes) << "B) prefetched " << prefetched_scenes;
+
+    if (placements > 1)
+        out << " | scene " << models << " models " << placements << " placed";
+
+    if (lod_triangles.size() > 1) {
+        out << " | lod";
+        for (auto i = 0u; i < lod_triangles.size(); ++i)
+            out << (i == 0 ? " " : "/") << format_count(lod_triangles[i]);
+    }
+
+    if (source_meshes > unique_meshes) {
+        out << " | inst " << unique_meshes << "/" << source_meshes;
+        out << " -" << format_count(instancing_bytes_saved) << "B";
+    }
+
+    return out.str();
+}
+
+viewer_stats stats;
+
+#endif
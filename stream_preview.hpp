@@ -0,0 +1,150 @@
+#ifndef STREAM_PREVIEW_HPP
+#define STREAM_PREVIEW_HPP
+
+#include <memory>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+// shows a large obj file while it is still being parsed. the parsed triangles come in chunks and are
+// appended to one growing vertex buffer of a scene that is drawn like any other, with the default
+// material and framed by the bounds of the vertices seen so far. the preview only exists on the gpu,
+// it is replaced by the processed scene as soon as that is resident
+
+class stream_preview {
+public:
+    std::shared_ptr<parse_stream> stream; //null while nothing is streamed
+    bool shown; //the viewer is drawing the preview scene
+    size_t bytes_parsed, total_bytes;
+    size_t resident_triangles;
+
+    stream_preview() : shown(false), bytes_parsed(0), total_bytes(0), resident_triangles(0), capacity(0), min_bound(FLT_MAX), max_bound(-FLT_MAX) {}
+
+    void begin(std::shared_ptr<parse_stream> next_stream);
+    void end();
+    std::unique_ptr<scene> create();
+    void append(scene& preview, const std::vector<vertex>& chunk);
+
+private:
+    size_t capacity; //vertices the buffers hold
+    glm::vec3 min_bound, max_bound;
+
+    void grow(unsigned int& buffer, size_t used_bytes, size_t bytes);
+};
+
+void stream_preview::begin(std::shared_ptr<parse_stream> next_stream) {
+    end();
+    stream = next_stream;
+}
+
+//the parser may still be running, it only stops handing out chunks
+void stream_preview::end() {
+    if (stream != nullptr)
+        stream->close();
+
+    stream.reset();
+    shown = false;
+    bytes_parsed = 0; total_bytes = 0;
+    resident_triangles = 0;
+}
+
+//one model with one mesh placed once, its buffers start out empty
+std::unique_ptr<scene> stream_preview::create() {
+    std::unique_ptr<scene> preview = std::make_unique<scene>();
+    preview->models.emplace_back();
+    preview->placements.push_back({ 0, glm::mat4(1.0f) });
+
+    model& streamed = preview->models.back();
+    streamed.meshes.emplace_back();
+    mesh& cur_mesh = streamed.meshes.back();
+    cur_mesh.mesh_mat = &streamed.materials["default_mat"];
+    cur_mesh.lods.push_back({ 0, 0, 0.0f });
+    cur_mesh.instance_transforms = { glm::mat4(1.0f) };
+    cur_mesh.set_placements({ glm::mat4(1.0f) });
+
+    glGenVertexArrays(1, &cur_mesh.vao);
+    glGenBuffers(1, &cur_mesh.instance_vbo);
+    glBindVertexArray(cur_mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, cur_mesh.instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * cur_mesh.draw_transforms.size(), cur_mesh.draw_transforms.data(), GL_STATIC_DRAW);
+    for (auto i = 0; i < 4; ++i) {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    capacity = 0;
+    min_bound = glm::vec3(FLT_MAX); max_bound = glm::vec3(-FLT_MAX);
+    return preview;
+}
+
+//copies into a buffer of the new size, the old one is deleted once the copy is queued
+void stream_preview::grow(unsigned int& buffer, size_t used_bytes, size_t bytes) {
+    unsigned int grown;
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+
+    if (buffer != 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used_bytes);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    buffer = grown;
+}
+
+//capacity doubles, so a file streamed in n chunks is copied on the gpu about log n times
+void stream_preview::append(scene& preview, const std::vector<vertex>& chunk) {
+    model& streamed = preview.models.back();
+    mesh& cur_mesh = streamed.meshes.back();
+    size_t used = cur_mesh.lods[0].index_count;
+
+    if (used + chunk.size() > capacity) {
+        size_t grown = std::max(capacity * 2, used + chunk.size());
+        grow(cur_mesh.vbo, used * sizeof(vertex), grown * sizeof(vertex));
+        grow(cur_mesh.ebo, used * sizeof(unsigned int), grown * sizeof(unsigned int));
+        capacity = grown;
+
+        glBindVertexArray(cur_mesh.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, cur_mesh.vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texture_coord));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, vertex_normal));
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cur_mesh.ebo);
+        glBindVertexArray(0);
+    }
+
+    //the triangles are unrolled, so the indices just count up
+    std::vector<unsigned int> indices(chunk.size());
+    std::iota(indices.begin(), indices.end(), static_cast<unsigned int>(used));
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, cur_mesh.vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, used * sizeof(vertex), chunk.size() * sizeof(vertex), chunk.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, cur_mesh.ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, used * sizeof(unsigned int), indices.size() * sizeof(unsigned int), indices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    cur_mesh.lods[0].index_count = static_cast<unsigned int>(used + chunk.size());
+    resident_triangles = cur_mesh.lods[0].index_count / 3;
+
+    //provisional framing, the processed scene brings its own bounds
+    for (auto& cur_vertex : chunk) {
+        min_bound = glm::min(min_bound, cur_vertex.vertex_coord);
+        max_bound = glm::max(max_bound, cur_vertex.vertex_coord);
+    }
+    streamed.centroid = (min_bound + max_bound) * 0.5f;
+    streamed.radius = std::max(glm::length(max_bound - min_bound) * 0.5f, 1e-6f);
+    cur_mesh.bounds_center = streamed.centroid;
+    cur_mesh.bounds_radius = streamed.radius;
+    preview.centroid = streamed.centroid;
+    preview.radius = streamed.radius;
+}
+
+#endif
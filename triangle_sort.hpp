@@ -0,0 +1,249 @@
+#ifndef TRIANGLE_SORT_HPP
+#define TRIANGLE_SORT_HPP
+
+#include <array>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_SORT_SSE2
+#endif
+
+// cpu sorted transparency: every drawn instance of a translucent mesh gets its triangles radix sorted
+// back to front by view depth and the sorted indices are streamed into one element buffer, uploaded once
+// per sort. it is still drawn with one draw call per instance, back to front: meshes have their own vertex
+// buffers, vertex formats and material textures, and core 3.3 has no base instance, so each call points
+// the instance attributes at its transform. instances are ordered by their bounds center, triangles are
+// only sorted within one. the order is rebuilt only when the view, the model matrix or a selected lod changes
+
+//float bits remapped so that unsigned order is float order
+uint32_t sortable_float_bits(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+//view space depth of every vertex, depth_row is the third row of view * model * instance
+void vertex_view_depths(const std::vector<vertex>& vertices, const glm::vec4& depth_row, std::vector<float>& depths) {
+    depths.resize(vertices.size());
+    size_t i = 0;
+
+#ifdef TRIANGLE_SORT_SSE2
+    __m128 row_x = _mm_set1_ps(depth_row.x), row_y = _mm_set1_ps(depth_row.y);
+    __m128 row_z = _mm_set1_ps(depth_row.z), row_w = _mm_set1_ps(depth_row.w);
+
+    for (; i + 4 <= vertices.size(); i += 4) {
+        const glm::vec3& p0 = vertices[i].vertex_coord, & p1 = vertices[i + 1].vertex_coord;
+        const glm::vec3& p2 = vertices[i + 2].vertex_coord, & p3 = vertices[i + 3].vertex_coord;
+        __m128 x = _mm_set_ps(p3.x, p2.x, p1.x, p0.x);
+        __m128 y = _mm_set_ps(p3.y, p2.y, p1.y, p0.y);
+        __m128 z = _mm_set_ps(p3.z, p2.z, p1.z, p0.z);
+
+        __m128 depth = _mm_add_ps(row_w, _mm_mul_ps(x, row_x));
+        depth = _mm_add_ps(depth, _mm_mul_ps(y, row_y));
+        depth = _mm_add_ps(depth, _mm_mul_ps(z, row_z));
+        _mm_storeu_ps(&depths[i], depth);
+    }
+#endif
+
+    for (; i < vertices.size(); ++i)
+        depths[i] = glm::dot(depth_row, glm::vec4(vertices[i].vertex_coord, 1.0f));
+}
+
+//stable lsd radix sort of key/value pairs, 8 bits per pass. with several blocks every pass counts digits
+//per block in parallel, a prefix over (digit, block) hands each block its output slots and the blocks
+//scatter in parallel
+void radix_sort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, bool parallel) {
+    const size_t min_block = 16384;
+    size_t n = keys.size();
+    size_t block_count = parallel ? std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), std::max<size_t>(1, n / min_block)) : 1;
+    size_t block_size = (n + block_count - 1) / std::max<size_t>(block_count, 1);
+    std::vector<uint32_t> keys_out(n), values_out(n);
+    std::vector<std::array<size_t, 256>> offsets(block_count);
+
+    auto for_blocks = [&](const std::function<void(size_t)>& job) {
+        if (block_count == 1)
+            job(0);
+        else
+            parallel_for(block_count, job, 1, "radix block");
+    };
+
+    for (auto shift = 0; shift < 32; shift += 8) {
+        for_blocks([&](size_t b) {
+            offsets[b].fill(0);
+            for (size_t i = b * block_size; i < std::min(n, (b + 1) * block_size); ++i)
+                ++offsets[b][(keys[i] >> shift) & 255];
+        });
+
+        //every key shares this digit, the pass would not move anything
+        bool single_digit = false;
+        for (auto d = 0; d < 256 && !single_digit; ++d) {
+            size_t digit_count = 0;
+            for (auto& block_offsets : offsets)
+                digit_count += block_offsets[d];
+            single_digit = digit_count == n;
+        }
+        if (single_digit)
+            continue;
+
+        size_t offset = 0;
+        for (auto d = 0; d < 256; ++d) {
+            for (auto& block_offsets : offsets) {
+                size_t digit_count = block_offsets[d];
+                block_offsets[d] = offset;
+                offset += digit_count;
+            }
+        }
+
+        for_blocks([&](size_t b) {
+            for (size_t i = b * block_size; i < std::min(n, (b + 1) * block_size); ++i) {
+                size_t slot = offsets[b][(keys[i] >> shift) & 255]++;
+                keys_out[slot] = keys[i];
+                values_out[slot] = values[i];
+            }
+        });
+
+        keys.swap(keys_out);
+        values.swap(values_out);
+    }
+}
+
+class sorted_draw {
+public:
+    mesh* draw_mesh;
+    unsigned int instance;
+    unsigned int index_offset, index_count;
+    float depth;
+};
+
+class triangle_sorter {
+public:
+    std::vector<sorted_draw> draws;
+    size_t sorted_triangles;
+    double sort_ms;
+
+    triangle_sorter() : sorted_triangles(0), sort_ms(0.0), ebo(0), valid(false) {}
+
+    void update(scene& s, const glm::mat4& view_model);
+    void invalidate() { valid = false; }
+    void draw(Shader& shader);
+
+    triangle_sorter(const triangle_sorter&) = delete;
+    triangle_sorter& operator=(const triangle_sorter&) = delete;
+
+    ~triangle_sorter() {
+        glDeleteBuffers(1, &ebo);
+    }
+
+private:
+    unsigned int ebo;
+    bool valid;
+    glm::mat4 sorted_view_model;
+    std::vector<std::pair<const mesh*, int>> sorted_lods;
+    std::vector<unsigned int> sorted_indices;
+};
+
+void triangle_sorter::update(scene& s, const glm::mat4& view_model) {
+    std::vector<std::pair<const mesh*, int>> lods;
+    for (auto& cur_model : s.models) {
+        for (auto& cur_mesh : cur_model.meshes) {
+            if (cur_mesh.mesh_mat->translucent && !cur_mesh.mesh_vertices.empty())
+                lods.push_back({ &cur_mesh, cur_mesh.cur_lod });
+        }
+    }
+
+    //camera and lods did not move since the last sort, the streamed order is still right
+    if (valid && view_model == sorted_view_model && lods == sorted_lods)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    draws.clear();
+    unsigned int index_count = 0;
+
+    for (auto& entry : lods) {
+        mesh* cur_mesh = const_cast<mesh*>(entry.first);
+        const lod_level& lod = cur_mesh->lods.at(cur_mesh->cur_lod);
+
+        for (auto i = 0u; i < cur_mesh->draw_transforms.size(); ++i) {
+            glm::vec4 center = view_model * cur_mesh->draw_transforms[i] * glm::vec4(cur_mesh->bounds_center, 1.0f);
+            draws.push_back({ cur_mesh, i, index_count, lod.index_count, center.z });
+            index_count += lod.index_count;
+        }
+    }
+
+    sorted_indices.resize(index_count);
+    bool parallel_sort = draws.size() < std::max(1u, std::thread::hardware_concurrency());
+
+    //few big draws sort each one on all threads, many small ones spread the draws over the threads
+    auto sort_draw = [&](size_t d) {
+        const sorted_draw& cur_draw = draws[d];
+        const mesh& cur_mesh = *cur_draw.draw_mesh;
+        const lod_level& lod = cur_mesh.lods.at(cur_mesh.cur_lod);
+        glm::mat4 transform = view_model * cur_mesh.draw_transforms[cur_draw.instance];
+        glm::vec4 depth_row(transform[0][2], transform[1][2], transform[2][2], transform[3][2]);
+
+        std::vector<float> depths;
+        vertex_view_depths(cur_mesh.mesh_vertices, depth_row, depths);
+
+        size_t triangle_count = lod.index_count / 3;
+        std::vector<uint32_t> keys(triangle_count), triangles(triangle_count);
+        const unsigned int* indices = cur_mesh.mesh_indices.data() + lod.index_offset;
+
+        //view space z grows towards the camera, so ascending order is back to front
+        for (auto t = 0u; t < triangle_count; ++t) {
+            keys[t] = sortable_float_bits(depths[indices[t * 3]] + depths[indices[t * 3 + 1]] + depths[indices[t * 3 + 2]]);
+            triangles[t] = t;
+        }
+
+        radix_sort(keys, triangles, parallel_sort);
+
+        unsigned int* out = sorted_indices.data() + cur_draw.index_offset;
+        for (auto t = 0u; t < triangle_count; ++t) {
+            out[t * 3] = indices[triangles[t] * 3];
+            out[t * 3 + 1] = indices[triangles[t] * 3 + 1];
+            out[t * 3 + 2] = indices[triangles[t] * 3 + 2];
+        }
+    };
+
+    if (parallel_sort) {
+        for (auto d = 0u; d < draws.size(); ++d)
+            sort_draw(d);
+    }
+    else {
+        parallel_for(draws.size(), sort_draw, 1, "sort draw");
+    }
+
+    std::sort(draws.begin(), draws.end(), [](const sorted_draw& l, const sorted_draw& r) {
+        return l.depth < r.depth;
+    });
+
+    //orphaned every sort so the driver does not wait on the previous frame's draws
+    if (ebo == 0)
+        glGenBuffers(1, &ebo);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(unsigned int) * sorted_indices.size(), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(unsigned int) * sorted_indices.size(), sorted_indices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    sorted_triangles = index_count / 3;
+    sorted_view_model = view_model;
+    sorted_lods = std::move(lods);
+    valid = true;
+    sort_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//one call per instance, see the top of the file
+void triangle_sorter::draw(Shader& shader) {
+    for (auto& cur_draw : draws)
+        cur_draw.draw_mesh->draw_sorted(shader, ebo, cur_draw.instance, cur_draw.index_offset, cur_draw.index_count);
+}
+
+#endif
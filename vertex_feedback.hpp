@@ -0,0 +1,87 @@
+#ifndef VERTEX_FEEDBACK_HPP
+#define VERTEX_FEEDBACK_HPP
+
+#include <vector>
+#include <utility>
+
+// transform feedback pre-pass for depth peeling: every vertex of every translucent mesh instance is
+// transformed once per frame into one buffer, and each peel pass then only fetches it through a
+// buffer texture instead of running the full vertex transform again
+
+const size_t transformed_vertex_bytes = 3 * 4 * sizeof(float);
+
+class vertex_feedback {
+public:
+    size_t transformed_vertices;
+
+    vertex_feedback() : transformed_vertices(0), buffer(0), buffer_texture(0), capacity(0) {}
+
+    void capture(scene& s, Shader& capture_shader);
+    void draw(Shader& shader, int texture_unit);
+
+    vertex_feedback(const vertex_feedback&) = delete;
+    vertex_feedback& operator=(const vertex_feedback&) = delete;
+
+    ~vertex_feedback() {
+        glDeleteBuffers(1, &buffer);
+        glDeleteTextures(1, &buffer_texture);
+    }
+
+private:
+    unsigned int buffer, buffer_texture;
+    size_t capacity;
+    std::vector<std::pair<mesh*, unsigned int>> captured; //mesh and its first vertex in the buffer
+};
+
+//capture_shader must be in use with its matrices set
+void vertex_feedback::capture(scene& s, Shader& capture_shader) {
+    captured.clear();
+    transformed_vertices = 0;
+
+    for (auto& cur_model : s.models) {
+        for (auto& cur_mesh : cur_model.meshes) {
+            if (cur_mesh.mesh_mat->translucent && !cur_mesh.mesh_vertices.empty()) {
+                captured.push_back({ &cur_mesh, static_cast<unsigned int>(transformed_vertices) });
+                transformed_vertices += cur_mesh.mesh_vertices.size() * cur_mesh.draw_transforms.size();
+            }
+        }
+    }
+
+    if (buffer == 0) {
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &buffer_texture);
+    }
+
+    //grows only, the same scene captures into the same storage every frame
+    if (transformed_vertices * transformed_vertex_bytes > capacity) {
+        capacity = transformed_vertices * transformed_vertex_bytes;
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, capacity, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_BUFFER, buffer_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (auto& entry : captured) {
+        mesh* cur_mesh = entry.first;
+        size_t bytes = cur_mesh->mesh_vertices.size() * cur_mesh->draw_transforms.size() * transformed_vertex_bytes;
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer, entry.second * transformed_vertex_bytes, bytes);
+        cur_mesh->capture_transformed(capture_shader);
+    }
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+}
+
+void vertex_feedback::draw(Shader& shader, int texture_unit) {
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, buffer_texture);
+    shader.setInt("transformed_vertices", texture_unit);
+
+    for (auto& entry : captured)
+        entry.first->draw_transformed(shader, entry.second);
+}
+
+#endif
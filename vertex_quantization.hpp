@@ -0,0 +1,75 @@
+#ifndef VERTEX_QUANTIZATION_HPP
+#define VERTEX_QUANTIZATION_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// 16 byte vertex: position as unorm16 inside the mesh bounding box, octahedral normal as snorm16,
+// uv as half floats. shader.vs undoes the position mapping with pos_scale/pos_offset
+
+class compact_vertex {
+public:
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texture_coord[2];
+};
+
+static_assert(sizeof(compact_vertex) == 16, "compact_vertex has to stay 16 bytes");
+
+glm::vec2 oct_encode(glm::vec3 n) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (l1 == 0.0f)
+        return glm::vec2(0.0f);
+
+    n /= l1;
+    glm::vec2 e(n.x, n.y);
+
+    //fold the lower hemisphere over the diagonals
+    if (n.z < 0.0f) {
+        e.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return e;
+}
+
+uint16_t quantize_unorm16(float v) {
+    return static_cast<uint16_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+int16_t quantize_snorm16(float v) {
+    return static_cast<int16_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+compact_vertex pack_vertex(const glm::vec3& position, const glm::vec2& texture_coord, const glm::vec3& normal, const glm::vec3& offset, const glm::vec3& scale) {
+    compact_vertex packed;
+
+    for (auto i = 0; i < 3; ++i)
+        packed.position[i] = scale[i] > 0.0f ? quantize_unorm16((position[i] - offset[i]) / scale[i]) : 0;
+    packed.position[3] = 0;
+
+    glm::vec2 oct = oct_encode(normal);
+    packed.normal[0] = quantize_snorm16(oct.x);
+    packed.normal[1] = quantize_snorm16(oct.y);
+
+    uint32_t uv = glm::packHalf2x16(texture_coord);
+    std::memcpy(packed.texture_coord, &uv, sizeof(uv));
+
+    return packed;
+}
+
+//worst case position error is half a quantization step on every axis
+float position_quantization_error(const glm::vec3& scale) {
+    return glm::length(scale / 65535.0f) * 0.5f;
+}
+
+//half floats keep 11 significant bits, so rounding is at most 2^-11 of the largest magnitude
+float uv_quantization_error(float max_abs_uv) {
+    return max_abs_uv / 2048.0f;
+}
+
+#endif